@@ -0,0 +1,123 @@
+#pragma once
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+//frames rendered before the frame loop is expected to stop allocating
+#define ALLOCATION_WARMUP_FRAMES 10
+
+//Counts heap allocations made through operator new, so the frame loop can check it stays allocation free.
+//The replacement operators are only compiled in with COUNT_ALLOCATIONS (cmake -DGLITTER_COUNT_ALLOCATIONS=ON),
+//this header must only be included from one source file. The plain, nothrow and (C++17) aligned forms are all counted.
+//Run with --frames N to render N frames after the warm-up and exit, failing if any of them allocated (ctest does this).
+class AllocationCounter {
+public:
+	static std::atomic<size_t>& Count() {
+		static std::atomic<size_t> count(0);
+		return count;
+	}
+
+	static bool Enabled() {
+#ifdef COUNT_ALLOCATIONS
+		return true;
+#else
+		return false;
+#endif
+	}
+};
+
+#ifdef COUNT_ALLOCATIONS
+void* operator new(size_t size) {
+	AllocationCounter::Count()++;
+	void* p = std::malloc(size ? size : 1);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size) {
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	AllocationCounter::Count()++;
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	std::free(p);
+}
+
+#ifdef __cpp_aligned_new
+static void* allocateAligned(size_t size, std::align_val_t alignment) {
+	size_t align = (size_t)alignment < sizeof(void*) ? sizeof(void*) : (size_t)alignment;
+#ifdef _MSC_VER
+	return _aligned_malloc(size ? size : 1, align);
+#else
+	void* p = NULL;
+	return posix_memalign(&p, align, size ? size : 1) == 0 ? p : NULL;
+#endif
+}
+
+static void freeAligned(void* p) {
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+	AllocationCounter::Count()++;
+	void* p = allocateAligned(size, alignment);
+	if (p == NULL)
+		throw std::bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+	return operator new(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	AllocationCounter::Count()++;
+	return allocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+	return operator new(size, alignment, std::nothrow);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+	freeAligned(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+	freeAligned(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+	freeAligned(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+	freeAligned(p);
+}
+#endif
+#endif
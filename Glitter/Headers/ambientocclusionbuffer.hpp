@@ -2,17 +2,24 @@
 #include "glitter.hpp"
 #include "shader.hpp"
 #include "gbuffer.hpp"
+#include "positionpyramid.hpp"
 #include <iostream>
 #include <vector>
 using std::vector;
 
+#ifndef SSAO_NUM_SAMPLES
 #define SSAO_NUM_SAMPLES 32
+#endif
+//uniform buffer binding point of the sample kernel
+#define SSAO_KERNEL_BINDING 0
 
 //SSAO
 class AmbientOcclusionBuffer {
 private:
 	//for SSAO
 	vector<glm::vec3> samples;
+	//samples in a std140 uniform buffer, uploaded once
+	GLuint kernelUBO;
 	GLuint noiseTexture;
 	GLuint FBO;
 	GLuint bufferSSAO;
@@ -38,6 +45,15 @@ public:
 			sample *= scale;
 			samples.push_back(sample);
 		}
+
+		//upload the kernel, std140 pads vec3 array elements to 16 bytes
+		vector<glm::vec4> kernel;
+		for (GLuint i = 0; i < SSAO_NUM_SAMPLES; i++)
+			kernel.push_back(glm::vec4(samples[i], 0.0f));
+		glGenBuffers(1, &kernelUBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, kernelUBO);
+		glBufferData(GL_UNIFORM_BUFFER, kernel.size() * sizeof(glm::vec4), &kernel[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
 	
 		//create noise
 		vector<glm::vec3> noise;
@@ -54,39 +70,38 @@ public:
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
-		//create fbo to store results of ssao stage
+		//create fbo to store results of ssao stage, at the reduced resolution
 		glGenFramebuffers(1, &FBO);
 		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
 		glGenTextures(1, &bufferSSAO);
 		glBindTexture(GL_TEXTURE_2D, bufferSSAO);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, mWidth, mHeight, 0, GL_RGB, GL_FLOAT, NULL);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, INDIRECT_WIDTH, INDIRECT_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bufferSSAO, 0);
 	}
 
 	void BindFramebuffer() {
-		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glViewport(0, 0, INDIRECT_WIDTH, INDIRECT_HEIGHT);
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, FBO);
 	}
 
-	void BindBuffersSSAO(Shader& ssaoShader, GBuffer& gbuffer) {
-		//bind necessary textures from gbuffer
+	void BindBuffersSSAO(Shader& ssaoShader, GBuffer& gbuffer, PositionPyramid& pyramid) {
+		//bind necessary textures from gbuffer, the samples read positions from the pyramid
 		gbuffer.BindBuffersSSAO(ssaoShader);
+		pyramid.BindBuffersSSAO(ssaoShader);
 		//as well as noise texture
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, noiseTexture);
-		glUniform1i(glGetUniformLocation(ssaoShader.Program, "texNoise"), 2);
+		GLState::BindTexture(2, GL_TEXTURE_2D, noiseTexture);
+		ssaoShader.SetInt("texNoise", 2);
 	}
 
 	void BindBuffersBlur(Shader& blurShader) {
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, bufferSSAO);
-		glUniform1i(glGetUniformLocation(blurShader.Program, "bufferInput"), 0);
+		GLState::BindTexture(0, GL_TEXTURE_2D, bufferSSAO);
+		blurShader.SetInt("bufferInput", 0);
 	}
 
-	void SetUniforms(Shader& ssaoShader) {
-		//samples
-		for (GLuint i = 0; i < SSAO_NUM_SAMPLES; i++)
-			glUniform3fv(glGetUniformLocation(ssaoShader.Program, ("samples[" + std::to_string(i) + "]").c_str()), 1, &samples[i][0]);
+	//Binds the sample kernel to its uniform block binding point
+	void BindKernel() {
+		glBindBufferBase(GL_UNIFORM_BUFFER, SSAO_KERNEL_BINDING, kernelUBO);
 	}
 };
\ No newline at end of file
@@ -2,47 +2,151 @@
 #include "glitter.hpp"
 #include "shader.hpp"
 #include "gbuffer.hpp"
+#include "ambientocclusionbuffer.hpp"
+#include "radiosityhistory.hpp"
 #include <iostream>
 #include <vector>
 using std::vector;
 
-//Single color blur
+//pixels of a line blurred by one work group of bilateralBlur.comp.glsl
+#ifndef BLUR_GROUP
+#define BLUR_GROUP 128
+#endif
+//work group size of bilateralUpsample.comp.glsl in each dimension
+#ifndef UPSAMPLE_GROUP
+#define UPSAMPLE_GROUP 8
+#endif
+
+//Separable depth and normal aware blur of the SSAO and radiosity outputs, run as two compute passes.
+//Both are computed at the reduced INDIRECT_DOWNSAMPLE resolution, blurred there and then upsampled to the screen.
 class BlurBuffer {
 private:
-	//frame buffer
+	//frame buffer the radiosity pass renders into
 	GLuint FBO;
-	//output texture
+	//radiosity output texture, with its confidence in alpha
 	GLuint bufferBlurColor;
+	//after the horizontal pass
+	GLuint occlusionTemp;
+	GLuint colorTemp;
+	//after the vertical pass, at the reduced resolution (only when downsampling)
+	GLuint occlusionLow;
+	GLuint radiosityLow;
+	//blurred results at screen resolution
+	GLuint bufferOcclusion;
+	GLuint bufferRadiosity;
+
+	static GLuint createTexture(GLenum format, GLuint width, GLuint height) {
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		return texture;
+	}
+
+	//one direction of the blur, from the texture bound to unit 0 into output
+	void blur(Shader& blurShader, GLuint output, GLenum format, bool horizontal) {
+		blurShader.SetInt("horizontal", horizontal);
+		glBindImageTexture(0, output, 0, GL_FALSE, 0, GL_WRITE_ONLY, format);
+		GLuint length = horizontal ? INDIRECT_WIDTH : INDIRECT_HEIGHT;
+		GLuint lines = horizontal ? INDIRECT_HEIGHT : INDIRECT_WIDTH;
+		glDispatchCompute((length + BLUR_GROUP - 1) / BLUR_GROUP, lines, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
+	void blurTwice(Shader& blurShader, GLuint temp, GLuint output, GLenum format) {
+		blurShader.SetInt("bufferInput", 0);
+		blurShader.SetInt("bufferOutput", 0);
+		blur(blurShader, temp, format, true);
+		GLState::BindTexture(0, GL_TEXTURE_2D, temp);
+		blur(blurShader, output, format, false);
+	}
+
+	//joint bilateral upsample from the texture bound to unit 0 into output, at screen resolution
+	void upsample(Shader& upsampleShader, GBuffer& gbuffer, GLuint input, GLuint output, GLenum format) {
+		upsampleShader.Use();
+		gbuffer.BindBuffersBlur(upsampleShader);
+		GLState::BindTexture(0, GL_TEXTURE_2D, input);
+		upsampleShader.SetInt("bufferInput", 0);
+		upsampleShader.SetInt("bufferOutput", 0);
+		glBindImageTexture(0, output, 0, GL_FALSE, 0, GL_WRITE_ONLY, format);
+		glDispatchCompute((mWidth + UPSAMPLE_GROUP - 1) / UPSAMPLE_GROUP, (mHeight + UPSAMPLE_GROUP - 1) / UPSAMPLE_GROUP, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+
 public:
-	BlurBuffer() {
+	BlurBuffer() : occlusionLow(0), radiosityLow(0) {
 		glGenFramebuffers(1, &FBO);
 		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
 		glGenTextures(1, &bufferBlurColor);
 		glBindTexture(GL_TEXTURE_2D, bufferBlurColor);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, mWidth, mHeight, 0, GL_RGB, GL_FLOAT, NULL);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, INDIRECT_WIDTH, INDIRECT_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bufferBlurColor, 0);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		//occlusion is a single channel
+		occlusionTemp = createTexture(GL_R16F, INDIRECT_WIDTH, INDIRECT_HEIGHT);
+		bufferOcclusion = createTexture(GL_R16F, mWidth, mHeight);
+		colorTemp = createTexture(GL_RGBA16F, INDIRECT_WIDTH, INDIRECT_HEIGHT);
+		bufferRadiosity = createTexture(GL_RGBA16F, mWidth, mHeight);
+		if (INDIRECT_DOWNSAMPLE > 1) {
+			occlusionLow = createTexture(GL_R16F, INDIRECT_WIDTH, INDIRECT_HEIGHT);
+			radiosityLow = createTexture(GL_RGBA16F, INDIRECT_WIDTH, INDIRECT_HEIGHT);
+		}
 	}
 
 	void BindFramebuffer() {
-		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glViewport(0, 0, INDIRECT_WIDTH, INDIRECT_HEIGHT);
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, FBO);
+	}
+
+	//Blurs the SSAO output and brings it to screen resolution, the shaders must be the r16f permutations
+	void BlurOcclusion(Shader& blurShader, Shader& upsampleShader, AmbientOcclusionBuffer& ssao, GBuffer& gbuffer) {
+		blurShader.Use();
+		gbuffer.BindBuffersBlur(blurShader);
+		ssao.BindBuffersBlur(blurShader);
+		if (INDIRECT_DOWNSAMPLE == 1) {
+			blurTwice(blurShader, occlusionTemp, bufferOcclusion, GL_R16F);
+			return;
+		}
+		blurTwice(blurShader, occlusionTemp, occlusionLow, GL_R16F);
+		upsample(upsampleShader, gbuffer, occlusionLow, bufferOcclusion, GL_R16F);
 	}
 
+	//Binds the radiosity rendered into this buffer as the input of the temporal filter
+	void BindBuffersTemporal(Shader& temporalShader) {
+		GLState::BindTexture(0, GL_TEXTURE_2D, bufferBlurColor);
+		temporalShader.SetInt("bufferInput", 0);
+	}
+
+	//Blurs the accumulated radiosity and brings it to screen resolution, the shaders must be the rgba16f permutations
+	void BlurRadiosity(Shader& blurShader, Shader& upsampleShader, RadiosityHistory& history, GBuffer& gbuffer) {
+		blurShader.Use();
+		gbuffer.BindBuffersBlur(blurShader);
+		history.BindBuffersBlur(blurShader);
+		if (INDIRECT_DOWNSAMPLE == 1) {
+			blurTwice(blurShader, colorTemp, bufferRadiosity, GL_RGBA16F);
+			return;
+		}
+		blurTwice(blurShader, colorTemp, radiosityLow, GL_RGBA16F);
+		upsample(upsampleShader, gbuffer, radiosityLow, bufferRadiosity, GL_RGBA16F);
+	}
 
 	void BindBuffersLighting(Shader& lightingShader, GBuffer& gbuffer) {
 		//bind necessary textures from gbuffer
 		gbuffer.BindBuffersLighting(lightingShader);
-		//as well as output from SSAO shader
-		glActiveTexture(GL_TEXTURE6);
-		glBindTexture(GL_TEXTURE_2D, bufferBlurColor);
-		glUniform1i(glGetUniformLocation(lightingShader.Program, "bufferOcclusion"), 6);
+		//as well as the blurred output from SSAO shader
+		GLState::BindTexture(6, GL_TEXTURE_2D, bufferOcclusion);
+		lightingShader.SetInt("bufferOcclusion", 6);
 	}
 
 	void BindBuffersRadiosity(Shader& blurRadiosityShader) {
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, bufferBlurColor);
-		glUniform1i(glGetUniformLocation(blurRadiosityShader.Program, "bufferRadiosity"), 0);
+		GLState::BindTexture(0, GL_TEXTURE_2D, bufferRadiosity);
+		blurRadiosityShader.SetInt("bufferRadiosity", 0);
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,139 @@
+#pragma once
+#include "filesystem.hpp"
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//Location of on-disk caches, relative to the resource root
+#define CACHE_DIRECTORY "Cache"
+
+//Helpers for the on-disk caches (meshes, textures, shaders)
+class Cache {
+public:
+	//64-bit FNV-1a hash, used to build cache keys
+	static uint64_t Hash(const void* data, size_t size, uint64_t hash = 14695981039346656037ULL) {
+		const unsigned char* bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	static uint64_t Hash(const std::string& str, uint64_t hash = 14695981039346656037ULL) {
+		return Hash(str.data(), str.size(), hash);
+	}
+
+	static std::string ToHex(uint64_t value) {
+		char buffer[17];
+		snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)value);
+		return std::string(buffer);
+	}
+
+	//Returns the path of a file in a subdirectory of the cache, creating the directories if needed
+	static std::string GetPath(const std::string& subdirectory, const std::string& name) {
+		std::string directory = FileSystem::getPath(CACHE_DIRECTORY);
+		createDirectory(directory);
+		directory += "/" + subdirectory;
+		createDirectory(directory);
+		return directory + "/" + name;
+	}
+
+	//Size and modification time of a file, used to detect stale cache entries
+	static bool GetFileStamp(const std::string& path, uint64_t& size, int64_t& time) {
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+			return false;
+		size = (uint64_t)info.st_size;
+		time = (int64_t)info.st_mtime;
+		return true;
+	}
+
+private:
+	static void createDirectory(const std::string& path) {
+#ifdef _WIN32
+		_mkdir(path.c_str());
+#else
+		mkdir(path.c_str(), 0755);
+#endif
+	}
+};
+
+//Read-only memory mapping of a whole file
+class MappedFile {
+private:
+	const unsigned char* data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int file;
+#endif
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	MappedFile(const std::string& path) : data(NULL), size(0) {
+#ifdef _WIN32
+		mapping = NULL;
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+			return;
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping == NULL)
+			return;
+		data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (data != NULL)
+			size = (size_t)fileSize.QuadPart;
+#else
+		file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+			return;
+		struct stat info;
+		if (fstat(file, &info) != 0 || info.st_size == 0)
+			return;
+		void* mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (mapped == MAP_FAILED)
+			return;
+		data = (const unsigned char*)mapped;
+		size = (size_t)info.st_size;
+#endif
+	}
+
+	~MappedFile() {
+#ifdef _WIN32
+		if (data != NULL)
+			UnmapViewOfFile(data);
+		if (mapping != NULL)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+#else
+		if (data != NULL)
+			munmap((void*)data, size);
+		if (file >= 0)
+			close(file);
+#endif
+	}
+
+	bool IsOpen() const { return data != NULL; }
+	const unsigned char* Data() const { return data; }
+	size_t Size() const { return size; }
+};
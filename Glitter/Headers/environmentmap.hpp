@@ -39,14 +39,12 @@ public:
 	}
 
 	void BindBuffers(Shader& envShader) {
-		glActiveTexture(GL_TEXTURE0);
-		glUniform1i(glGetUniformLocation(envShader.Program, "envMap"), 0);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMap);
+		envShader.SetInt("envMap", 0);
+		GLState::BindTexture(0, GL_TEXTURE_CUBE_MAP, cubeMap);
 	}
 
 	void BindBuffers(Shader& envShader, int textureUnit) {
-		glActiveTexture(GL_TEXTURE0 + textureUnit);
-		glUniform1i(glGetUniformLocation(envShader.Program, "envMap"), textureUnit);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMap);
+		envShader.SetInt("envMap", textureUnit);
+		GLState::BindTexture(textureUnit, GL_TEXTURE_CUBE_MAP, cubeMap);
 	}
 };
\ No newline at end of file
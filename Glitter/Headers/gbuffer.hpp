@@ -4,30 +4,60 @@
 #include <iostream>
 #include <vector>
 
-//2 depth layers
+//2 depth layers, it is injected into the shaders but only two layers are generated (see geometry.frag.glsl)
+#ifndef GBUFFER_LAYERS
 #define GBUFFER_LAYERS 2
+#endif
+static_assert(GBUFFER_LAYERS == 2, "the G-buffer passes only generate a first and a second layer");
+
+//AO and radiosity are computed at 1/INDIRECT_DOWNSAMPLE of the screen resolution (1, 2 or 4)
+//and upsampled guided by the G-buffer
+#ifndef INDIRECT_DOWNSAMPLE
+#define INDIRECT_DOWNSAMPLE 1
+#endif
+#define INDIRECT_WIDTH ((mWidth + INDIRECT_DOWNSAMPLE - 1) / INDIRECT_DOWNSAMPLE)
+#define INDIRECT_HEIGHT ((mHeight + INDIRECT_DOWNSAMPLE - 1) / INDIRECT_DOWNSAMPLE)
+
+//minimum separation between layers (in world space units)
+#ifndef MINIMUM_SEPARATION
+#define MINIMUM_SEPARATION 1
+#endif
+
+//How the second layer finds the first layer it must be separated from
+#define GBUFFER_PREVIOUS 0 //last frame's first layer at the same pixel
+#define GBUFFER_REPROJECT 1 //last frame's first layer, reprojected into this frame
+#define GBUFFER_DELAY 2 //this frame's first layer, predicted last frame by rendering one frame behind the camera
+#define GBUFFER_TWO_PASS 3 //this frame's first layer from a separate pass (depth peeling), exact
+#define GBUFFER_MODES 4
 
 //G-Buffer for deferred shading
+//The depth buffer is ping-ponged between two framebuffers, so last frame's first layer can be read back
+//for the second layer's minimum separation test without copying it.
 class GBuffer {
 private:
-	//frame buffer object to render geometry to
-	GLuint FBO;
+	//frame buffer objects to render geometry to, one per depth buffer
+	GLuint FBO[2];
 	//buffer attachment textures where data is stored
 	GLuint bufferPosition;
 	GLuint bufferNormal;
 	GLuint bufferColor;
 	//GLuint bufferLambertian;
 	//GLuint bufferSpecular;
-	GLuint bufferDepth;
+	GLuint bufferDepth[2];
+	//index of this frame's depth buffer, the other one holds last frame's
+	GLuint current;
+	//next frame's first layer depth, for GBUFFER_DELAY
+	GLuint predictFBO;
+	GLuint bufferDepthPredicted;
 
-	//previous frame's first layer depth buffer
-	GLuint bufferDepthCompare;
+	//camera of last frame, for reprojecting into its depth buffer
+	glm::mat4 prevView;
+	glm::mat4 prevProjection;
 
 public:
-	GBuffer() {
-		//create framebuffer
-		glGenFramebuffers(1, &FBO);
-		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	GBuffer() : current(0) {
+		//create framebuffers
+		glGenFramebuffers(2, FBO);
 
 		//create textures for each layer
 		//position buffer - a "color" buffer
@@ -38,7 +68,6 @@ public:
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, bufferPosition, 0);
 
 		//normal buffer - a "color" buffer, use rgb for xyz
 		glGenTextures(1, &bufferNormal);
@@ -46,7 +75,6 @@ public:
 		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB16F, mWidth, mHeight, GBUFFER_LAYERS, 0, GL_RGB, GL_FLOAT, NULL);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, bufferNormal, 0);
 
 		//color buffer - put diffuse in rgb, specular in a
 		glGenTextures(1, &bufferColor);
@@ -54,99 +82,144 @@ public:
 		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, mWidth, mHeight, GBUFFER_LAYERS, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, bufferColor, 0);
-
-		//set as attachments to FBO
-		GLuint attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-		glDrawBuffers(3, attachments);
-
-		//add depth buffer
-		//depth buffer has an extra layer, at bufferDepth[GBUFFER_LAYERS] which is used for comparison
-		glGenTextures(1, &bufferDepth);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferDepth);
-		//glTexStorage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, mWidth, mHeight, GBUFFER_LAYERS + 1);
-		//glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, mWidth, mHeight, GBUFFER_LAYERS + 1, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, mWidth, mHeight, GBUFFER_LAYERS, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+
+		//attach them to both framebuffers, each with its own depth buffer
+		glGenTextures(2, bufferDepth);
+		for (GLuint i = 0; i < 2; i++) {
+			glBindFramebuffer(GL_FRAMEBUFFER, FBO[i]);
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, bufferPosition, 0);
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, bufferNormal, 0);
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, bufferColor, 0);
+
+			//set as attachments to FBO
+			GLuint attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+			glDrawBuffers(3, attachments);
+
+			glBindTexture(GL_TEXTURE_2D_ARRAY, bufferDepth[i]);
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, mWidth, mHeight, GBUFFER_LAYERS, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, bufferDepth[i], 0);
+
+			//make sure framebuffer was built successfully
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+				std::cout << "Error setting up G-Buffer " << glGetError() << std::endl;
+			//the first frame compares against an empty depth buffer
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+
+		//depth only framebuffer for predicting the first layer
+		glGenFramebuffers(1, &predictFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, predictFBO);
+		glGenTextures(1, &bufferDepthPredicted);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferDepthPredicted);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, mWidth, mHeight, 1, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		//glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, bufferDepth, 0);
-
-		//make sure framebuffer was built successfully
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, bufferDepthPredicted, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
 		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-			std::cout << "Error setting up G-Buffer " << glGetError() << std::endl;
+			std::cout << "Error setting up G-Buffer prediction " << glGetError() << std::endl;
+		glClear(GL_DEPTH_BUFFER_BIT);
 
 		//unbind FBO
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-		//create comparison depth buffer
-		glGenTextures(1, &bufferDepthCompare);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferDepthCompare);
-		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, mWidth, mHeight, GBUFFER_LAYERS - 1, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 	}
 
 	void BindFramebuffer() {
-		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, FBO[current]);
 	}
 
-	void CopyAndBindDepthCompareLayer(Shader& geometryShader) {
-		//copy first layer of last frame's depth buffer into comparison texture and bind it
-		glCopyImageSubData(bufferDepth, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, bufferDepthCompare, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, mWidth, mHeight, GBUFFER_LAYERS - 1);
+	//Starts a frame: renders into the other depth buffer and binds the first layer depth the second layer is compared against,
+	//with the matrices taking this frame's camera space into that depth buffer's (see the GBUFFER_ modes)
+	void SwapAndBindDepthCompareLayer(Shader& geometryShader, const glm::mat4& view, const glm::mat4& projection, int mode) {
+		GLuint previous = current;
+		current = 1 - current;
+
+		//bind to texture unit 0
+		GLState::BindTexture(0, GL_TEXTURE_2D_ARRAY, mode == GBUFFER_DELAY ? bufferDepthPredicted : bufferDepth[previous]);
+		geometryShader.SetInt("bufferDepthCompare", 0);
+		//only last frame's depth buffer was rendered with another camera
+		geometryShader.SetMat4("reprojection", mode == GBUFFER_REPROJECT ? prevView * glm::inverse(view) : glm::mat4());
+		geometryShader.SetMat4("prevProjection", mode == GBUFFER_REPROJECT ? prevProjection : projection);
+
+		prevView = view;
+		prevProjection = projection;
+	}
+
+	//For GBUFFER_TWO_PASS, between the passes: copies this frame's first layer depth over the one bound for comparison
+	void CopyDepthCompareLayer() {
+		glCopyImageSubData(bufferDepth[current], GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, bufferDepth[1 - current], GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, mWidth, mHeight, 1);
+	}
 
-		//and bind to texture unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferDepthCompare);
-		glUniform1i(glGetUniformLocation(geometryShader.Program, "bufferDepthCompare"), 0);
+	//For GBUFFER_DELAY, binds the depth buffer next frame's first layer is rendered into
+	void BindFramebufferPrediction() {
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, predictFBO);
+		glViewport(0, 0, mWidth, mHeight);
 	}
 
 	void BindBuffersSSAO(Shader& ssaoShader) {
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferPosition);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferNormal);
+		GLState::BindTexture(0, GL_TEXTURE_2D_ARRAY, bufferPosition);
+		GLState::BindTexture(1, GL_TEXTURE_2D_ARRAY, bufferNormal);
+
+		ssaoShader.SetInt("bufferPosition", 0);
+		ssaoShader.SetInt("bufferNormal", 1);
+	}
 
-		glUniform1i(glGetUniformLocation(ssaoShader.Program, "bufferPosition"), 0);
-		glUniform1i(glGetUniformLocation(ssaoShader.Program, "bufferNormal"), 1);
+	void BindBuffersPositionPyramid(Shader& mipShader) {
+		GLState::BindTexture(0, GL_TEXTURE_2D_ARRAY, bufferPosition);
+		mipShader.SetInt("source", 0);
+	}
+
+	void BindBuffersBlur(Shader& blurShader) {
+		GLState::BindTexture(1, GL_TEXTURE_2D_ARRAY, bufferPosition);
+		GLState::BindTexture(2, GL_TEXTURE_2D_ARRAY, bufferNormal);
+		blurShader.SetInt("bufferPosition", 1);
+		blurShader.SetInt("bufferNormal", 2);
+	}
+
+	void BindBuffersLightCulling(Shader& cullShader) {
+		GLState::BindTexture(0, GL_TEXTURE_2D_ARRAY, bufferPosition);
+		cullShader.SetInt("bufferPosition", 0);
+	}
+
+	void BindBuffersError(Shader& errorShader) {
+		GLState::BindTexture(0, GL_TEXTURE_2D_ARRAY, bufferPosition);
+		errorShader.SetInt("bufferPosition", 0);
 	}
 
 	void BindBuffersLighting(Shader& lightingShader) {
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferPosition);
-		glActiveTexture(GL_TEXTURE4);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferNormal);
-		glActiveTexture(GL_TEXTURE5);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferColor);
+		GLState::BindTexture(3, GL_TEXTURE_2D_ARRAY, bufferPosition);
+		GLState::BindTexture(4, GL_TEXTURE_2D_ARRAY, bufferNormal);
+		GLState::BindTexture(5, GL_TEXTURE_2D_ARRAY, bufferColor);
 
-		glUniform1i(glGetUniformLocation(lightingShader.Program, "bufferPosition"), 3);
-		glUniform1i(glGetUniformLocation(lightingShader.Program, "bufferNormal"), 4);
-		glUniform1i(glGetUniformLocation(lightingShader.Program, "bufferColor"), 5);
+		lightingShader.SetInt("bufferPosition", 3);
+		lightingShader.SetInt("bufferNormal", 4);
+		lightingShader.SetInt("bufferColor", 5);
 	}
 
 	void BindBuffersRadiosity(Shader& radiosityShader) {
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferPosition);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferNormal);
-		//glActiveTexture(GL_TEXTURE3);
-		//glBindTexture(GL_TEXTURE_2D_ARRAY, bufferColor);
-
-		glUniform1i(glGetUniformLocation(radiosityShader.Program, "bufferPosition"), 0);
-		glUniform1i(glGetUniformLocation(radiosityShader.Program, "bufferNormal"), 1);
-		//glUniform1i(glGetUniformLocation(radiosityShader.Program, "bufferRadiosity"), 3);
+		GLState::BindTexture(0, GL_TEXTURE_2D_ARRAY, bufferPosition);
+		GLState::BindTexture(1, GL_TEXTURE_2D_ARRAY, bufferNormal);
+		//diffuse colors reflect the earlier bounces
+		GLState::BindTexture(6, GL_TEXTURE_2D_ARRAY, bufferColor);
+
+		radiosityShader.SetInt("bufferPosition", 0);
+		radiosityShader.SetInt("bufferNormal", 1);
+		radiosityShader.SetInt("bufferColor", 6);
 	}
 
 	// Copies depth buffer from G-Buffer to standard framebuffer 0
 	void CopyDepthBuffer() {
-		glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		GLState::BindFramebuffer(GL_READ_FRAMEBUFFER, FBO[current]);
+		GLState::BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
 		glBlitFramebuffer(0, 0, mWidth, mHeight, 0, 0, mWidth, mHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
 };
\ No newline at end of file
@@ -0,0 +1,139 @@
+#pragma once
+#include "glitter.hpp"
+#include "shader.hpp"
+#include "gbuffer.hpp"
+#include "model.hpp"
+#include <iostream>
+
+//shader storage binding point of the error counters
+#define GBUFFER_ERROR_BINDING 5
+//work group size of gbufferError.comp.glsl in each dimension
+#ifndef GBUFFER_ERROR_GROUP
+#define GBUFFER_ERROR_GROUP 8
+#endif
+//frames the counters are read back after, so reading them never waits for the GPU
+#define GBUFFER_ERROR_LATENCY 3
+
+//Counters written by gbufferError.comp.glsl for one frame
+struct GBufferError {
+	//second layer pixels that are missing, extra, or more than 1% off in depth
+	GLuint wrongPixels;
+	//sum of the relative depth errors, in 1/1000ths
+	GLuint errorSum;
+};
+
+//Exact second layer depth by two-pass depth peeling, rendered depth-only, and the per-pixel error of the
+//G-buffer's second layer against it. Results are accumulated over frames until they are printed.
+class GBufferReference {
+private:
+	GLuint layerFBO[2];
+	GLuint bufferDepth[2];
+	//one counter buffer per frame in flight
+	GLuint errorBuffers[GBUFFER_ERROR_LATENCY];
+	bool pending[GBUFFER_ERROR_LATENCY];
+	GLuint current;
+	//accumulated since the last Print
+	double wrongPixels;
+	double errorSum;
+	GLuint frames;
+
+	GBufferReference(const GBufferReference&);
+	GBufferReference& operator=(const GBufferReference&);
+
+	//adds up and clears a frame's counters
+	void collect(GLuint index) {
+		GBufferError counters;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, errorBuffers[index]);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GBufferError), &counters);
+		GBufferError zero = { 0, 0 };
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GBufferError), &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		wrongPixels += counters.wrongPixels;
+		errorSum += counters.errorSum / 1000.0;
+		frames++;
+		pending[index] = false;
+	}
+
+public:
+	GBufferReference() : current(0), wrongPixels(0.0), errorSum(0.0), frames(0) {
+		glGenFramebuffers(2, layerFBO);
+		glGenTextures(2, bufferDepth);
+		for (GLuint i = 0; i < 2; i++) {
+			glBindTexture(GL_TEXTURE_2D, bufferDepth[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, mWidth, mHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glBindFramebuffer(GL_FRAMEBUFFER, layerFBO[i]);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, bufferDepth[i], 0);
+			glDrawBuffer(GL_NONE);
+			glReadBuffer(GL_NONE);
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+				std::cout << "Error setting up G-Buffer reference " << glGetError() << std::endl;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		GBufferError zero = { 0, 0 };
+		glGenBuffers(GBUFFER_ERROR_LATENCY, errorBuffers);
+		for (GLuint i = 0; i < GBUFFER_ERROR_LATENCY; i++) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, errorBuffers[i]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GBufferError), &zero, GL_DYNAMIC_READ);
+			pending[i] = false;
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	//Renders the exact two layers depth-only: the first layer, then the closest depths behind it by the minimum separation
+	void Render(Shader& depthShader, Shader& peelShader, Model& model, const glm::mat4& modelMatrix, const glm::mat4& view, const glm::mat4& projection) {
+		glViewport(0, 0, mWidth, mHeight);
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, layerFBO[0]);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		depthShader.Use();
+		depthShader.SetMat4("model", modelMatrix);
+		depthShader.SetMat4("view", view);
+		depthShader.SetMat4("projection", projection);
+		model.DrawDepth();
+
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, layerFBO[1]);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		peelShader.Use();
+		GLState::BindTexture(0, GL_TEXTURE_2D, bufferDepth[0]);
+		peelShader.SetInt("firstLayer", 0);
+		peelShader.SetFloat("nearPlane", mNear);
+		peelShader.SetFloat("farPlane", mFar);
+		peelShader.SetMat4("model", modelMatrix);
+		peelShader.SetMat4("view", view);
+		peelShader.SetMat4("projection", projection);
+		model.DrawDepth();
+	}
+
+	//Counts where the G-buffer's second layer differs from the reference, the reference must be rendered this frame
+	void Measure(Shader& errorShader, GBuffer& gbuffer) {
+		if (pending[current])
+			collect(current);
+		errorShader.Use();
+		gbuffer.BindBuffersError(errorShader);
+		GLState::BindTexture(1, GL_TEXTURE_2D, bufferDepth[1]);
+		errorShader.SetInt("referenceDepth", 1);
+		errorShader.SetFloat("nearPlane", mNear);
+		errorShader.SetFloat("farPlane", mFar);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GBUFFER_ERROR_BINDING, errorBuffers[current]);
+		glDispatchCompute((mWidth + GBUFFER_ERROR_GROUP - 1) / GBUFFER_ERROR_GROUP, (mHeight + GBUFFER_ERROR_GROUP - 1) / GBUFFER_ERROR_GROUP, 1);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		pending[current] = true;
+		current = (current + 1) % GBUFFER_ERROR_LATENCY;
+	}
+
+	//Prints the error averaged over the frames measured since the last call, and starts over
+	void Print() {
+		for (GLuint i = 0; i < GBUFFER_ERROR_LATENCY; i++)
+			if (pending[i])
+				collect(i);
+		if (frames > 0) {
+			double pixels = (double)frames * mWidth * mHeight;
+			std::cout << "second layer error over " << frames << " frames: " << 100.0 * wrongPixels / pixels << "% pixels wrong, mean relative depth error "
+				<< errorSum / pixels << std::endl;
+		}
+		wrongPixels = errorSum = 0.0;
+		frames = 0;
+	}
+};
@@ -0,0 +1,145 @@
+#pragma once
+#include "glitter.hpp"
+#include "mesh.hpp"
+#include "glstate.hpp"
+#include <vector>
+
+// Layout of a glMultiDrawElementsIndirect record
+struct DrawCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	// Always 0, no instanced attributes are read
+	GLuint baseInstance;
+};
+
+//One vertex/index buffer shared by all meshes of a model, with the per-draw records submitted through multi-draw indirect
+class GeometryBuffer {
+private:
+	GLuint VAO, VBO, EBO;
+	GLuint indirectBuffer;
+	//draw records built on the CPU each frame
+	GLuint dynamicBuffer;
+	//position-only stream and its VAO for depth passes (VERTEX_POSITION_STREAM), sharing the index buffer
+	GLuint depthVAO, positionVBO;
+	GLuint commandCount;
+	//next free vertex/index in the buffers
+	GLuint vertexEnd, indexEnd;
+	GLuint vertexCapacity, indexCapacity;
+
+	GeometryBuffer(const GeometryBuffer&);
+	GeometryBuffer& operator=(const GeometryBuffer&);
+
+public:
+	VertexLayout layout;
+
+	GeometryBuffer(VertexLayout layout = VertexLayout()) : VAO(0), VBO(0), EBO(0), indirectBuffer(0), dynamicBuffer(0), depthVAO(0), positionVBO(0), commandCount(0),
+		vertexEnd(0), indexEnd(0), vertexCapacity(0), indexCapacity(0), layout(layout) {}
+
+	//Creates the buffers with room for all vertices and indices of the model
+	void Allocate(GLuint numVertices, GLuint numIndices) {
+		vertexCapacity = numVertices;
+		indexCapacity = numIndices;
+		vertexEnd = indexEnd = 0;
+
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glGenBuffers(1, &EBO);
+		glGenBuffers(1, &indirectBuffer);
+		glGenBuffers(1, &dynamicBuffer);
+
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)numVertices * layout.stride, NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)numIndices * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+		layout.SetAttributes();
+		glBindVertexArray(0);
+
+		if (layout.attributes & VERTEX_POSITION_STREAM) {
+			glGenVertexArrays(1, &depthVAO);
+			glGenBuffers(1, &positionVBO);
+			glBindVertexArray(depthVAO);
+			glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+			glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)numVertices * sizeof(glm::vec3), NULL, GL_STATIC_DRAW);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+			glBindVertexArray(0);
+		}
+	}
+
+	//Copies a mesh's geometry into the next free range and records where it went
+	void Append(const Vertex* vertices, const GLuint* indices, Mesh& mesh) {
+		if (vertexEnd + mesh.vertexCount > vertexCapacity || indexEnd + mesh.indexCount > indexCapacity)
+			return;
+		mesh.baseVertex = vertexEnd;
+		mesh.firstIndex = indexEnd;
+
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		if (!layout.Packed()) {
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)vertexEnd * layout.stride, (GLsizeiptr)mesh.vertexCount * sizeof(Vertex), vertices);
+		}
+		else {
+			//quantize into the compact layout first
+			std::vector<unsigned char> packed(mesh.vertexCount * layout.stride);
+			layout.Pack(vertices, mesh.vertexCount, packed.data());
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)vertexEnd * layout.stride, packed.size(), packed.data());
+		}
+		if (positionVBO != 0) {
+			std::vector<glm::vec3> positions(mesh.vertexCount);
+			for (GLuint i = 0; i < mesh.vertexCount; i++)
+				positions[i] = vertices[i].Position;
+			glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+			glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)vertexEnd * sizeof(glm::vec3), positions.size() * sizeof(glm::vec3), positions.data());
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		//the element buffer binding is VAO state
+		glBindVertexArray(VAO);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, (GLintptr)indexEnd * sizeof(GLuint), (GLsizeiptr)mesh.indexCount * sizeof(GLuint), indices);
+		glBindVertexArray(0);
+
+		vertexEnd += mesh.vertexCount;
+		indexEnd += mesh.indexCount;
+	}
+
+	//Uploads the draw records
+	void SetCommands(const std::vector<DrawCommand>& commands) {
+		commandCount = commands.size();
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawCommand), commands.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	//Binds the vertex array and draw records, they stay bound for the following passes
+	void Bind() {
+		GLState::BindVertexArray(VAO);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	}
+
+	//Binds the position-only stream if there is one, the full vertex layout otherwise
+	void BindDepth() {
+		GLState::BindVertexArray(depthVAO != 0 ? depthVAO : VAO);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	}
+
+	GLuint CommandCount() const { return commandCount; }
+
+	//Submits a range of draw records with a single call, the buffer must be bound
+	void Draw(GLuint firstCommand, GLuint numCommands) {
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid*)(firstCommand * sizeof(DrawCommand)), numCommands, 0);
+	}
+
+	//Submits draw records built this frame with a single call, the buffer must be bound
+	void DrawDynamic(const DrawCommand* commands, GLuint numCommands) {
+		if (numCommands == 0)
+			return;
+		//respecifying the data orphans the records of the previous call instead of waiting for its draws
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, dynamicBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, numCommands * sizeof(DrawCommand), commands, GL_STREAM_DRAW);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const GLvoid*)0, numCommands, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+	}
+};
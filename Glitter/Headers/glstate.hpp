@@ -0,0 +1,131 @@
+#pragma once
+#include <glad/glad.h>
+#include <iostream>
+
+//texture units tracked by the state cache
+#define GL_STATE_TEXTURE_UNITS 16
+//state that hasn't been set through GLState since the last Invalidate()
+#define GL_STATE_UNKNOWN 0xFFFFFFFF
+
+//Tracks the bound program, textures, framebuffers and vertex array and skips binds that wouldn't change anything.
+//Every per-frame bind goes through here, setup code may bind directly as long as Invalidate() is called afterwards.
+class GLState {
+private:
+	struct State {
+		GLuint program;
+		GLuint activeUnit;
+		GLenum textureTargets[GL_STATE_TEXTURE_UNITS];
+		GLuint textures[GL_STATE_TEXTURE_UNITS];
+		GLuint readFramebuffer;
+		GLuint drawFramebuffer;
+		GLuint vertexArray;
+		//calls made and skipped this frame and last frame
+		unsigned int issued, elided;
+		unsigned int lastIssued, lastElided;
+	};
+
+	static State& state() {
+		static State s = initialState();
+		return s;
+	}
+
+	static State initialState() {
+		State s;
+		s.issued = s.elided = s.lastIssued = s.lastElided = 0;
+		reset(s);
+		return s;
+	}
+
+	static void reset(State& s) {
+		s.program = GL_STATE_UNKNOWN;
+		s.activeUnit = GL_STATE_UNKNOWN;
+		for (GLuint i = 0; i < GL_STATE_TEXTURE_UNITS; i++) {
+			s.textureTargets[i] = GL_STATE_UNKNOWN;
+			s.textures[i] = GL_STATE_UNKNOWN;
+		}
+		s.readFramebuffer = GL_STATE_UNKNOWN;
+		s.drawFramebuffer = GL_STATE_UNKNOWN;
+		s.vertexArray = GL_STATE_UNKNOWN;
+	}
+
+	//counts a call, returns whether it has to be issued
+	static bool changed(GLuint& current, GLuint value) {
+		State& s = state();
+		if (current == value) {
+			s.elided++;
+			return false;
+		}
+		current = value;
+		s.issued++;
+		return true;
+	}
+
+public:
+	//Forgets all tracked state, call after binding anything directly
+	static void Invalidate() {
+		reset(state());
+	}
+
+	static void UseProgram(GLuint program) {
+		if (changed(state().program, program))
+			glUseProgram(program);
+	}
+
+	//Binds a texture to a unit, only switching the active unit when the texture isn't bound there already
+	static void BindTexture(GLuint unit, GLenum target, GLuint texture) {
+		State& s = state();
+		if (unit >= GL_STATE_TEXTURE_UNITS) {
+			glActiveTexture(GL_TEXTURE0 + unit);
+			glBindTexture(target, texture);
+			s.activeUnit = unit;
+			s.issued += 2;
+			return;
+		}
+		//an unneeded bind also saves its glActiveTexture
+		if (s.textures[unit] == texture && s.textureTargets[unit] == target) {
+			s.elided += 2;
+			return;
+		}
+		if (changed(s.activeUnit, unit))
+			glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(target, texture);
+		s.textures[unit] = texture;
+		s.textureTargets[unit] = target;
+		s.issued++;
+	}
+
+	//Binds a framebuffer, GL_FRAMEBUFFER sets both the read and draw framebuffer
+	static void BindFramebuffer(GLenum target, GLuint framebuffer) {
+		State& s = state();
+		if (target == GL_FRAMEBUFFER) {
+			if (s.readFramebuffer == framebuffer && s.drawFramebuffer == framebuffer) {
+				s.elided++;
+				return;
+			}
+			s.readFramebuffer = s.drawFramebuffer = framebuffer;
+			s.issued++;
+			glBindFramebuffer(target, framebuffer);
+		}
+		else if (changed(target == GL_READ_FRAMEBUFFER ? s.readFramebuffer : s.drawFramebuffer, framebuffer))
+			glBindFramebuffer(target, framebuffer);
+	}
+
+	static void BindVertexArray(GLuint vertexArray) {
+		if (changed(state().vertexArray, vertexArray))
+			glBindVertexArray(vertexArray);
+	}
+
+	//Closes the frame's counters
+	static void EndFrame() {
+		State& s = state();
+		s.lastIssued = s.issued;
+		s.lastElided = s.elided;
+		s.issued = s.elided = 0;
+	}
+
+	//Prints the last frame's counters
+	static void PrintCounters() {
+		State& s = state();
+		std::cout << "GL state calls last frame: " << s.lastIssued << " issued, " << s.lastElided << " elided" << std::endl;
+	}
+};
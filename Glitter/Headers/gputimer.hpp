@@ -0,0 +1,56 @@
+#pragma once
+#include <glad/glad.h>
+
+//frames a query is read back after, so reading it never waits for the GPU
+#define GPU_TIMER_LATENCY 3
+//weight of the newest measurement in the running average
+#define GPU_TIMER_SMOOTHING 0.05
+
+//Measures the GPU time spent on a range of commands with GL_TIME_ELAPSED queries.
+//Queries are cycled, so results arrive a few frames late. Only one timer can be running at a time.
+class GPUTimer {
+private:
+	GLuint queries[GPU_TIMER_LATENCY];
+	bool pending[GPU_TIMER_LATENCY];
+	GLuint current;
+	//running average in milliseconds, it starts from the first result
+	double average;
+	bool measured;
+
+	GPUTimer(const GPUTimer&);
+	GPUTimer& operator=(const GPUTimer&);
+
+public:
+	GPUTimer() : current(0), average(0.0), measured(false) {
+		glGenQueries(GPU_TIMER_LATENCY, queries);
+		for (GLuint i = 0; i < GPU_TIMER_LATENCY; i++)
+			pending[i] = false;
+	}
+
+	~GPUTimer() {
+		glDeleteQueries(GPU_TIMER_LATENCY, queries);
+	}
+
+	void Begin() {
+		//collect the result of the query about to be reused
+		if (pending[current]) {
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queries[current], GL_QUERY_RESULT, &elapsed);
+			average += (elapsed / 1000000.0 - average) * (measured ? GPU_TIMER_SMOOTHING : 1.0);
+			measured = true;
+			pending[current] = false;
+		}
+		glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+	}
+
+	void End() {
+		glEndQuery(GL_TIME_ELAPSED);
+		pending[current] = true;
+		current = (current + 1) % GPU_TIMER_LATENCY;
+	}
+
+	//Average time between Begin and End, in milliseconds
+	double Milliseconds() const {
+		return average;
+	}
+};
@@ -3,41 +3,58 @@
 #include "glitter.hpp"
 #include "shader.hpp"
 #include <glm/glm.hpp>
+#include <string>
+#include <cfloat>
+#include <cmath>
 
+#ifndef SHADOW_MAP_RESOLUTION
 #define SHADOW_MAP_RESOLUTION 1024
+#endif
 #define SHADOW_NEAR 1.0f
 #define SHADOW_FAR 25.0f
+//attenuated intensity below which a light is treated as not reaching a point, the lighting pass fades
+//lights out smoothly towards it so the cut isn't visible
+#define LIGHT_CUTOFF (1.0f / 32.0f)
+
+//A light as laid out in the std430 light buffer, each vec3 is padded out by a scalar
+struct LightData {
+	//world space, so the buffer doesn't change when the camera moves
+	glm::vec3 pos;
+	float a;
+	glm::vec3 ambient;
+	float b;
+	glm::vec3 diffuse;
+	float c;
+	glm::vec3 specular;
+	//cubemap of the light in the shadow atlas, -1 if it casts no shadow
+	GLint shadowIndex;
+	//distance at which the light falls below LIGHT_CUTOFF
+	float radius;
+	float padding[3];
+};
 
 class Light {
 private:
 	//Shadows
-	//depth map
-	GLuint depthCubemap;
-	//framebuffer
-	GLuint depthMapFBO;
-	
-	void initializeDepthMap() {
-		//create shadow cubemap
-		glGenTextures(1, &depthCubemap);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
-		for (GLuint i = 0; i < 6; i++)
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, SHADOW_MAP_RESOLUTION, SHADOW_MAP_RESOLUTION, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-		//create FBO
-		glGenFramebuffers(1, &depthMapFBO);
-		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCubemap, 0);
-		glDrawBuffer(GL_NONE);
-		glReadBuffer(GL_NONE);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	}
+	//light-space transformation of each cube face
+	glm::mat4 shadowTransforms[6];
 
 	//Unique ID
 	int id;
+	//cubemap in the shadow atlas, handed out by ShadowAtlas::Assign, -1 without one
+	int shadowIndex;
+
+	//state the shadow map was last rendered with, it's only redrawn when the light or geometry in its range moves
+	bool shadowValid;
+	glm::vec3 shadowPosition;
+	glm::mat4 shadowModel;
+	glm::vec3 shadowBoundsMin, shadowBoundsMax;
+
+	//whether a box intersects the sphere the shadow map covers
+	bool inRange(glm::vec3 boundsMin, glm::vec3 boundsMax) const {
+		glm::vec3 closest = glm::clamp(position, boundsMin, boundsMax);
+		return glm::dot(closest - position, closest - position) <= SHADOW_FAR * SHADOW_FAR;
+	}
 public:
 	//Light Properties
 	//location
@@ -49,7 +66,7 @@ public:
 	//attenuation constants
 	float a, b, c;
 
-	Light() {
+	Light() : id(0), shadowIndex(-1), shadowValid(false) {
 		ambient = glm::vec3(0.1, 0.1, 0.1);
 		diffuse = glm::vec3(0.7, 0.7, 0.7);
 		specular = glm::vec3(1.0, 1.0, 1.0);
@@ -67,8 +84,8 @@ public:
 		this->b = b;
 		this->c = c;
 		this->id = id;
-
-		initializeDepthMap();
+		this->shadowIndex = -1;
+		this->shadowValid = false;
 	}
 
 	Light(glm::vec3 position, glm::vec3 ambient, glm::vec3 diffuse, glm::vec3 specular, float a, float b, float c, int id) {
@@ -80,57 +97,85 @@ public:
 		this->b = b;
 		this->c = c;
 		this->id = id;
-
-		initializeDepthMap();
+		this->shadowIndex = -1;
+		this->shadowValid = false;
 	}
 
-	void BindFramebuffer(Shader& depthShader, glm::mat4 view) {
-		glViewport(0, 0, SHADOW_MAP_RESOLUTION, SHADOW_MAP_RESOLUTION);
-		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-		glClear(GL_DEPTH_BUFFER_BIT);
+	//Whether the shadow map has to be redrawn for geometry drawn with this model matrix and world-space bounds.
+	//The cubemap is in world space, so camera movement never invalidates it.
+	bool ShadowNeedsUpdate(const glm::mat4& model, glm::vec3 boundsMin, glm::vec3 boundsMax) const {
+		if (!shadowValid || position != shadowPosition)
+			return true;
+		//geometry moved: only matters if it was or is now in range
+		return model != shadowModel && (inRange(boundsMin, boundsMax) || inRange(shadowBoundsMin, shadowBoundsMax));
+	}
 
-		//also set uniforms needed for depth map rendering
-		//convert position to view space
-		glm::vec3 posView = glm::vec3(view * glm::vec4(position, 1.0));
+	//Forces the shadow map to be redrawn next frame
+	void InvalidateShadow() {
+		shadowValid = false;
+	}
 
-		//transformations to light-space for each face
-		std::vector<glm::mat4> shadowTransforms;
+	//Starts redrawing the shadow map, remembering what it is rendered with.
+	//It only counts as valid once MarkShadowQueued() confirms it was queued for drawing.
+	void BeginShadow(const glm::mat4& model, glm::vec3 boundsMin, glm::vec3 boundsMax) {
+		shadowPosition = position;
+		shadowModel = model;
+		shadowBoundsMin = boundsMin;
+		shadowBoundsMax = boundsMax;
 
-		//create light-space transformation matrices for each cube face
+		//create world-space light transformation matrices for each cube face
 		glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), 1.0f, SHADOW_NEAR, SHADOW_FAR);
-		shadowTransforms.push_back(shadowProj * glm::lookAt(posView, posView + glm::vec3(1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0)));
-		shadowTransforms.push_back(shadowProj * glm::lookAt(posView, posView + glm::vec3(-1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0)));
-		shadowTransforms.push_back(shadowProj * glm::lookAt(posView, posView + glm::vec3(0.0, 1.0, 0.0), glm::vec3(0.0, 0.0, 1.0)));
-		shadowTransforms.push_back(shadowProj * glm::lookAt(posView, posView + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, -1.0)));
-		shadowTransforms.push_back(shadowProj * glm::lookAt(posView, posView + glm::vec3(0.0, 0.0, 1.0), glm::vec3(0.0, -1.0, 0.0)));
-		shadowTransforms.push_back(shadowProj * glm::lookAt(posView, posView + glm::vec3(0.0, 0.0, -1.0), glm::vec3(0.0, -1.0, 0.0)));
-
-		//set uniforms
-		depthShader.Use();
-		for (GLuint i = 0; i < 6; ++i)
-			glUniformMatrix4fv(glGetUniformLocation(depthShader.Program, ("shadowMatrices[" + std::to_string(i) + "]").c_str()), 1, GL_FALSE, glm::value_ptr(shadowTransforms[i]));
-		glUniform1f(glGetUniformLocation(depthShader.Program, "farPlane"), mFar);
-		glUniform3fv(glGetUniformLocation(depthShader.Program, "lightPos"), 1, &posView[0]);
+		shadowTransforms[0] = shadowProj * glm::lookAt(position, position + glm::vec3(1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
+		shadowTransforms[1] = shadowProj * glm::lookAt(position, position + glm::vec3(-1.0, 0.0, 0.0), glm::vec3(0.0, -1.0, 0.0));
+		shadowTransforms[2] = shadowProj * glm::lookAt(position, position + glm::vec3(0.0, 1.0, 0.0), glm::vec3(0.0, 0.0, 1.0));
+		shadowTransforms[3] = shadowProj * glm::lookAt(position, position + glm::vec3(0.0, -1.0, 0.0), glm::vec3(0.0, 0.0, -1.0));
+		shadowTransforms[4] = shadowProj * glm::lookAt(position, position + glm::vec3(0.0, 0.0, 1.0), glm::vec3(0.0, -1.0, 0.0));
+		shadowTransforms[5] = shadowProj * glm::lookAt(position, position + glm::vec3(0.0, 0.0, -1.0), glm::vec3(0.0, -1.0, 0.0));
+	}
+
+	//The shadow map begun last is being drawn, it stays cached until the light or geometry in range moves
+	void MarkShadowQueued() {
+		shadowValid = true;
+	}
+
+	const glm::mat4& ShadowTransform(GLuint face) const {
+		return shadowTransforms[face];
+	}
+
+	//Distance at which the attenuated light falls below LIGHT_CUTOFF: solves a*d^2 + b*d + c = intensity / cutoff
+	float Radius() const {
+		glm::vec3 color = ambient + diffuse + specular;
+		float target = glm::max(color.r, glm::max(color.g, color.b)) / LIGHT_CUTOFF;
+		if (target <= c)
+			return 0.0f;
+		if (a <= 0.0f)
+			return b > 0.0f ? (target - c) / b : FLT_MAX;
+		return (-b + sqrtf(b * b - 4.0f * a * (c - target))) / (2.0f * a);
+	}
+
+	//Cubemap of the light in the shadow atlas, -1 if it has none
+	int ShadowIndex() const {
+		return shadowIndex;
 	}
 
-	void SetUniforms(Shader& lightShader, glm::mat4 view) {
-		lightShader.Use();
-		//light properties
-		//convert position to view space
-		glm::vec3 lightPosView = glm::vec3(view * glm::vec4(position, 1.0));
-		glUniform3f(glGetUniformLocation(lightShader.Program, ("lights[" + to_string(id) + "].pos").c_str()), lightPosView.x, lightPosView.y, lightPosView.z);
-		glUniform3f(glGetUniformLocation(lightShader.Program, ("lights[" + to_string(id) + "].ambient").c_str()), ambient.r, ambient.g, ambient.b);
-		glUniform3f(glGetUniformLocation(lightShader.Program, ("lights[" + to_string(id) + "].diffuse").c_str()), diffuse.r, diffuse.g, diffuse.b);
-		glUniform3f(glGetUniformLocation(lightShader.Program, ("lights[" + to_string(id) + "].specular").c_str()), specular.r, specular.g, specular.b);
-		glUniform1f(glGetUniformLocation(lightShader.Program, ("lights[" + to_string(id) + "].a").c_str()), a);
-		glUniform1f(glGetUniformLocation(lightShader.Program, ("lights[" + to_string(id) + "].b").c_str()), b);
-		glUniform1f(glGetUniformLocation(lightShader.Program, ("lights[" + to_string(id) + "].c").c_str()), c);
+	void SetShadowIndex(int index) {
+		shadowIndex = index;
+		shadowValid = false;
 	}
 
-	void BindBuffers(Shader& lightShader) {
-		//bind depthmap to texture unit #id
-		glActiveTexture(GL_TEXTURE0 + id);
-		glUniform1i(glGetUniformLocation(lightShader.Program, ("depthMap[" + to_string(id) + "]").c_str()), id);
-		glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
+	//Light properties for the light buffer, with the position in world space
+	LightData GetData() const {
+		LightData data;
+		data.pos = position;
+		data.a = a;
+		data.ambient = ambient;
+		data.b = b;
+		data.diffuse = diffuse;
+		data.c = c;
+		data.specular = specular;
+		data.shadowIndex = shadowIndex;
+		data.radius = Radius();
+		data.padding[0] = data.padding[1] = data.padding[2] = 0.0f;
+		return data;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+#include "glitter.hpp"
+#include "light.hpp"
+#include <vector>
+#include <cstring>
+
+//shader storage binding point of the light buffer
+#define LIGHT_BUFFER_BINDING 2
+//bytes before the light array in the buffer: the light count, padded to the array's alignment
+#define LIGHT_BUFFER_HEADER 16
+
+//All lights in one std430 shader storage buffer, preceded by their count.
+//Positions are in world space, it's re-uploaded with a single call only when a light changed.
+class LightBuffer {
+private:
+	GLuint SSBO;
+	//contents of the buffer as last uploaded
+	std::vector<LightData> data;
+	std::vector<LightData> next;
+	//lights the buffer has room for
+	GLuint capacity;
+	bool uploaded;
+
+	LightBuffer(const LightBuffer&);
+	LightBuffer& operator=(const LightBuffer&);
+
+	void allocate(GLuint numLights) {
+		capacity = numLights;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, SSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, LIGHT_BUFFER_HEADER + numLights * sizeof(LightData), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		uploaded = false;
+	}
+
+public:
+	LightBuffer(GLuint numLights) : data(numLights), next(numLights), capacity(0), uploaded(false) {
+		glGenBuffers(1, &SSBO);
+		allocate(numLights);
+	}
+
+	//Rebuilds the light buffer and uploads it if anything differs
+	void Update(const std::vector<Light>& lights) {
+		//the light count only changes when lights are added or removed, not in steady state
+		if (lights.size() > capacity)
+			allocate(lights.size());
+		next.resize(lights.size());
+		for (GLuint i = 0; i < next.size(); i++)
+			next[i] = lights[i].GetData();
+		if (uploaded && next.size() == data.size() && (next.empty() || memcmp(&next[0], &data[0], data.size() * sizeof(LightData)) == 0))
+			return;
+		data.swap(next);
+		GLint header[LIGHT_BUFFER_HEADER / sizeof(GLint)] = { (GLint)data.size() };
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, SSBO);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, LIGHT_BUFFER_HEADER, header);
+		if (!data.empty())
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, LIGHT_BUFFER_HEADER, data.size() * sizeof(LightData), &data[0]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		uploaded = true;
+	}
+
+	GLuint Count() const {
+		return data.size();
+	}
+
+	void Bind() {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_BUFFER_BINDING, SSBO);
+	}
+};
@@ -0,0 +1,51 @@
+#pragma once
+#include "glitter.hpp"
+#include "shader.hpp"
+#include "gbuffer.hpp"
+
+//screen tile size in pixels, also the culling work group size
+#ifndef LIGHT_TILE_SIZE
+#define LIGHT_TILE_SIZE 16
+#endif
+//most lights a tile lists, if more reach into it the ones nearest to the tile are kept
+#ifndef MAX_LIGHTS_PER_TILE
+#define MAX_LIGHTS_PER_TILE 63
+#endif
+//shader storage binding point of the tile light lists
+#define TILE_BUFFER_BINDING 4
+
+#define LIGHT_TILES_X ((mWidth + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE)
+#define LIGHT_TILES_Y ((mHeight + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE)
+
+//Tiled light culling: a compute pass bounds the view-space depth of each screen tile over all G-buffer layers
+//and lists the lights whose range reaches into it, so the lighting pass only loops over those.
+//Each tile's list is its light count followed by MAX_LIGHTS_PER_TILE light indices. Past the cap, the lights are
+//sorted by distance to the tile and light index, so which lights are kept doesn't depend on thread timing.
+//Light indices are packed in 16 bits for the sort, at most 65536 lights are supported.
+class LightCulling {
+private:
+	GLuint tileBuffer;
+
+	LightCulling(const LightCulling&);
+	LightCulling& operator=(const LightCulling&);
+
+public:
+	LightCulling() {
+		glGenBuffers(1, &tileBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, tileBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, LIGHT_TILES_X * LIGHT_TILES_Y * (MAX_LIGHTS_PER_TILE + 1) * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	//Builds the tile light lists from this frame's G-buffer, the light buffer must be bound
+	void Cull(Shader& cullShader, GBuffer& gbuffer, const glm::mat4& view, const glm::mat4& projection) {
+		cullShader.Use();
+		gbuffer.BindBuffersLightCulling(cullShader);
+		cullShader.SetMat4("view", view);
+		cullShader.SetMat4("invProjection", glm::inverse(projection));
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TILE_BUFFER_BINDING, tileBuffer);
+		glDispatchCompute(LIGHT_TILES_X, LIGHT_TILES_Y, 1);
+		//the lighting pass reads the lists
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+};
@@ -2,14 +2,26 @@
 // Std. Includes
 #include <string>
 #include <fstream>
-#include <sstream>
 #include <iostream>
 #include <vector>
 using namespace std;
 // GL Includes
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
-
+#include <glm/gtc/packing.hpp>
+#include <cstring>
+#include <cmath>
+
+// Vertex attributes the shader passes can consume, used to pick the vertex layout
+#define VERTEX_POSITION 0x1
+#define VERTEX_NORMAL 0x2
+#define VERTEX_TEXCOORDS 0x4
+#define VERTEX_TANGENTS 0x8
+#define VERTEX_ALL (VERTEX_POSITION | VERTEX_NORMAL | VERTEX_TEXCOORDS | VERTEX_TANGENTS)
+// Quantize the attributes instead of storing full floats
+#define VERTEX_PACKED 0x10
+// Also keep a tightly packed position-only copy of the vertices for depth-only passes
+#define VERTEX_POSITION_STREAM 0x20
 
 struct Vertex {
 	// Position
@@ -24,121 +36,158 @@ struct Vertex {
 	glm::vec3 Bitangent;
 };
 
+// Quantized vertex: full precision position, octahedral snorm16 normal, half float UVs (20 bytes).
+// The octahedral tangent frame is only stored when a pass reads it (28 bytes).
+struct PackedVertex {
+	glm::vec3 Position;
+	GLuint Normal;
+	GLuint TexCoords;
+	GLuint Tangent;
+	GLuint Bitangent;
+};
+
+// Interleaved vertex layout used for the GPU copy of the vertices
+class VertexLayout {
+public:
+	GLuint attributes;
+	GLsizei stride;
+
+	VertexLayout(GLuint attributes = VERTEX_ALL) : attributes(attributes)
+	{
+		if (!this->Packed())
+			this->stride = sizeof(Vertex);
+		else if (attributes & VERTEX_TANGENTS)
+			this->stride = sizeof(PackedVertex);
+		else
+			this->stride = offsetof(PackedVertex, Tangent);
+	}
+
+	bool Packed() const { return (this->attributes & VERTEX_PACKED) != 0; }
+
+	// Converts vertices to this layout, out must hold count * stride bytes
+	void Pack(const Vertex* vertices, GLuint count, unsigned char* out) const
+	{
+		if (!this->Packed())
+		{
+			memcpy(out, vertices, count * sizeof(Vertex));
+			return;
+		}
+		for (GLuint i = 0; i < count; i++)
+		{
+			PackedVertex packed;
+			packed.Position = vertices[i].Position;
+			packed.Normal = glm::packSnorm2x16(octahedralEncode(vertices[i].Normal));
+			packed.TexCoords = glm::packHalf2x16(vertices[i].TexCoords);
+			packed.Tangent = glm::packSnorm2x16(octahedralEncode(vertices[i].Tangent));
+			packed.Bitangent = glm::packSnorm2x16(octahedralEncode(vertices[i].Bitangent));
+			memcpy(out + i * this->stride, &packed, this->stride);
+		}
+	}
+
+	// Sets the attribute pointers of the bound VAO for the bound vertex buffer
+	void SetAttributes() const
+	{
+		if (!this->Packed())
+		{
+			// Vertex Positions
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+			// Vertex Normals
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+			// Vertex Texture Coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+			// Vertex Tangent
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Tangent));
+			// Vertex Bitangent
+			glEnableVertexAttribArray(4);
+			glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Bitangent));
+			return;
+		}
+		// Vertex Positions
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, this->stride, (GLvoid*)0);
+		// Octahedral Normals, decoded in the vertex shader
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, this->stride, (GLvoid*)offsetof(PackedVertex, Normal));
+		// Half float Texture Coords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, this->stride, (GLvoid*)offsetof(PackedVertex, TexCoords));
+		if (this->attributes & VERTEX_TANGENTS)
+		{
+			// Octahedral Tangent and Bitangent
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 2, GL_SHORT, GL_TRUE, this->stride, (GLvoid*)offsetof(PackedVertex, Tangent));
+			glEnableVertexAttribArray(4);
+			glVertexAttribPointer(4, 2, GL_SHORT, GL_TRUE, this->stride, (GLvoid*)offsetof(PackedVertex, Bitangent));
+		}
+	}
+
+private:
+	// Maps a unit vector onto the octahedron, then unfolds the lower half onto the square
+	static glm::vec2 octahedralEncode(glm::vec3 n)
+	{
+		float sum = fabs(n.x) + fabs(n.y) + fabs(n.z);
+		if (sum == 0.0f)
+			return glm::vec2(0.0f, 0.0f);
+		n /= sum;
+		if (n.z >= 0.0f)
+			return glm::vec2(n.x, n.y);
+		return glm::vec2((1.0f - fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+	}
+};
+
 struct Texture {
 	GLuint id;
 	string type;
 	aiString path;
 };
 
+// A mesh is a range of its model's shared geometry buffer plus the textures it is drawn with
 class Mesh {
 public:
 	/*  Mesh Data  */
+	// CPU copy of the geometry, only kept for freshly imported meshes
 	vector<Vertex> vertices;
 	vector<GLuint> indices;
 	vector<Texture> textures;
-	GLuint VAO;
+	/*  Location in the shared geometry buffer  */
+	GLuint vertexCount;
+	GLuint indexCount;
+	GLint baseVertex;
+	GLuint firstIndex;
+	// Index of the material (set of textures) the mesh is drawn with
+	GLuint material;
+	// Object-space bounding box
+	glm::vec3 boundsMin, boundsMax;
 
 	/*  Functions  */
 	// Constructor
 	Mesh(vector<Vertex> vertices, vector<GLuint> indices, vector<Texture> textures)
+		: vertexCount(vertices.size()), indexCount(indices.size()), baseVertex(0), firstIndex(0), material(0)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
-
-		// Now that we have all the required data, set the vertex buffers and its attribute pointers.
-		this->setupMesh();
 	}
 
-	// Render the mesh
-	void Draw(Shader shader)
+	// Constructor for meshes whose geometry is uploaded from external memory (e.g. a mapped mesh cache) without keeping a copy
+	Mesh(GLuint numVertices, GLuint numIndices, vector<Texture> textures)
+		: vertexCount(numVertices), indexCount(numIndices), baseVertex(0), firstIndex(0), material(0)
 	{
-		// Bind appropriate textures
-		GLuint diffuseNr = 1;
-		GLuint specularNr = 1;
-		GLuint normalNr = 1;
-		GLuint heightNr = 1;
-		for (GLuint i = 0; i < this->textures.size(); i++)
-		{
-			//Modified:
-			//Depth cubemaps for each 3 lights use texture units 0 through 2, so mesh textures start at 3
-			glActiveTexture(GL_TEXTURE1+ i); // Active proper texture unit before binding
-											  // Retrieve texture number (the N in diffuse_textureN)
-			stringstream ss;
-			string number;
-			string name = this->textures[i].type;
-			if (name == "texture_diffuse")
-				ss << diffuseNr++; // Transfer GLuint to stream
-			else if (name == "texture_specular")
-				ss << specularNr++; // Transfer GLuint to stream
-			else if (name == "texture_normal")
-				ss << normalNr++; // Transfer GLuint to stream
-			else if (name == "texture_height")
-				ss << heightNr++; // Transfer GLuint to stream
-			number = ss.str();
-			// Now set the sampler to the correct texture unit
-			
-			glUniform1i(glGetUniformLocation(shader.Program, (name + number).c_str()), 1+i);
-			// And finally bind the texture
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
-		}
-
-		// Draw mesh
-		glBindVertexArray(this->VAO);
-		glDrawElements(GL_TRIANGLES, this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
-
-		// Always good practice to set everything back to defaults once configured.
-		for (GLuint i = 0; i < this->textures.size(); i++)
-		{
-			glActiveTexture(GL_TEXTURE0 + i);
-			glBindTexture(GL_TEXTURE_2D, 0);
-		}
+		this->textures = textures;
 	}
 
-private:
-	/*  Render data  */
-	GLuint VBO, EBO;
-
-	/*  Functions    */
-	// Initializes all the buffer objects/arrays
-	void setupMesh()
+	// Computes the bounding box from the mesh's vertices
+	void ComputeBounds(const Vertex* vertices)
 	{
-		// Create buffers/arrays
-		glGenVertexArrays(1, &this->VAO);
-		glGenBuffers(1, &this->VBO);
-		glGenBuffers(1, &this->EBO);
-
-		glBindVertexArray(this->VAO);
-		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-		// A great thing about structs is that their memory layout is sequential for all its items.
-		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
-
-		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-		// Vertex Tangent
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Tangent));
-		// Vertex Bitangent
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Bitangent));
-
-		glBindVertexArray(0);
+		this->boundsMin = this->boundsMax = this->vertexCount > 0 ? vertices[0].Position : glm::vec3(0.0f);
+		for (GLuint i = 1; i < this->vertexCount; i++)
+		{
+			this->boundsMin = glm::min(this->boundsMin, vertices[i].Position);
+			this->boundsMax = glm::max(this->boundsMax, vertices[i].Position);
+		}
 	}
 };
-
-
@@ -0,0 +1,260 @@
+#pragma once
+#include "cache.hpp"
+#include "mesh.hpp"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+//Bump whenever the file layout or the import processing changes
+#define MESH_CACHE_VERSION 3
+#define MESH_CACHE_ALIGNMENT 16
+
+//Binary cache of imported meshes so warm starts can skip Assimp entirely.
+//Layout: header | mesh entries | dependency entries | texture entries | string table | vertex/index blobs.
+//Dependencies are the files the import read besides the model (an .obj's material libraries), a cache is stale
+//if any of them changed too.
+//The blobs are aligned so meshes can be uploaded straight from a memory mapping of the file.
+class MeshCache {
+private:
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t vertexSize;
+		uint32_t meshCount;
+		uint32_t textureCount;
+		uint32_t dependencyCount;
+		uint32_t stringsSize;
+		//size and modification time of the source model, to detect stale caches
+		uint64_t sourceSize;
+		int64_t sourceTime;
+	};
+
+	struct MeshEntry {
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		uint32_t firstTexture;
+		uint32_t textureCount;
+	};
+
+	//a file the import depends on, its path relative to the model's directory is in the string table
+	struct DependencyEntry {
+		uint32_t pathOffset;
+		uint32_t padding;
+		//zero if the file didn't exist
+		uint64_t size;
+		int64_t time;
+	};
+
+	//offsets into the string table
+	struct TextureEntry {
+		uint32_t typeOffset;
+		uint32_t pathOffset;
+	};
+
+	MappedFile file;
+	const Header* header;
+	const MeshEntry* meshes;
+	const TextureEntry* textures;
+	const char* strings;
+
+	static size_t align(size_t offset) {
+		return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(size_t)(MESH_CACHE_ALIGNMENT - 1);
+	}
+
+	static bool fits(uint64_t offset, uint64_t size, size_t fileSize) {
+		return offset <= fileSize && size <= fileSize - offset;
+	}
+
+	static std::string directoryOf(const std::string& path) {
+		return path.substr(0, path.find_last_of('/') + 1);
+	}
+
+	//Stamp of a dependency, a missing file stamps as zero so it's noticed when it appears
+	static void dependencyStamp(const std::string& path, uint64_t& size, int64_t& time) {
+		if (!Cache::GetFileStamp(path, size, time))
+			size = time = 0;
+	}
+
+	//Material libraries named by the mtllib statements of an .obj, relative to its directory
+	static vector<std::string> materialLibraries(const std::string& sourcePath) {
+		vector<std::string> libraries;
+		if (sourcePath.size() < 4 || sourcePath.compare(sourcePath.size() - 4, 4, ".obj") != 0)
+			return libraries;
+		std::ifstream in(sourcePath.c_str());
+		std::string line;
+		while (std::getline(in, line)) {
+			if (line.compare(0, 7, "mtllib ") != 0)
+				continue;
+			std::istringstream names(line.substr(7));
+			std::string name;
+			while (names >> name)
+				libraries.push_back(name);
+		}
+		return libraries;
+	}
+
+	//Checks that the mapped file is a complete cache of the current version for the given source
+	bool validate(const std::string& sourcePath) {
+		size_t size = file.Size();
+		if (!file.IsOpen() || size < sizeof(Header))
+			return false;
+		const Header* h = (const Header*)file.Data();
+		if (std::memcmp(h->magic, "GMSH", 4) != 0 || h->version != MESH_CACHE_VERSION || h->vertexSize != sizeof(Vertex))
+			return false;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		if (!Cache::GetFileStamp(sourcePath, sourceSize, sourceTime) || sourceSize != h->sourceSize || sourceTime != h->sourceTime)
+			return false;
+
+		uint64_t offset = sizeof(Header);
+		uint64_t tablesSize = (uint64_t)h->meshCount * sizeof(MeshEntry) + (uint64_t)h->dependencyCount * sizeof(DependencyEntry)
+			+ (uint64_t)h->textureCount * sizeof(TextureEntry) + h->stringsSize;
+		if (!fits(offset, tablesSize, size) || h->stringsSize == 0 || file.Data()[offset + tablesSize - 1] != '\0')
+			return false;
+		const MeshEntry* entries = (const MeshEntry*)(file.Data() + offset);
+		const DependencyEntry* dependencies = (const DependencyEntry*)(entries + h->meshCount);
+		const TextureEntry* textureEntries = (const TextureEntry*)(dependencies + h->dependencyCount);
+		const char* stringTable = (const char*)(textureEntries + h->textureCount);
+		for (GLuint i = 0; i < h->dependencyCount; i++) {
+			if (dependencies[i].pathOffset >= h->stringsSize)
+				return false;
+			uint64_t dependencySize;
+			int64_t dependencyTime;
+			dependencyStamp(directoryOf(sourcePath) + (stringTable + dependencies[i].pathOffset), dependencySize, dependencyTime);
+			if (dependencySize != dependencies[i].size || dependencyTime != dependencies[i].time)
+				return false;
+		}
+		for (GLuint i = 0; i < h->meshCount; i++) {
+			const MeshEntry& e = entries[i];
+			if (!fits(e.vertexOffset, (uint64_t)e.vertexCount * sizeof(Vertex), size) || !fits(e.indexOffset, (uint64_t)e.indexCount * sizeof(GLuint), size))
+				return false;
+			if ((uint64_t)e.firstTexture + e.textureCount > h->textureCount)
+				return false;
+		}
+		for (GLuint i = 0; i < h->textureCount; i++) {
+			if (textureEntries[i].typeOffset >= h->stringsSize || textureEntries[i].pathOffset >= h->stringsSize)
+				return false;
+		}
+
+		header = h;
+		meshes = entries;
+		textures = textureEntries;
+		strings = stringTable;
+		return true;
+	}
+
+public:
+	//Maps the cache file and validates it against the source model
+	MeshCache(const std::string& cachePath, const std::string& sourcePath) : file(cachePath), header(NULL), meshes(NULL), textures(NULL), strings(NULL) {
+		validate(sourcePath);
+	}
+
+	bool IsValid() const { return header != NULL; }
+	GLuint MeshCount() const { return header->meshCount; }
+
+	const Vertex* Vertices(GLuint mesh) const { return (const Vertex*)(file.Data() + meshes[mesh].vertexOffset); }
+	GLuint VertexCount(GLuint mesh) const { return meshes[mesh].vertexCount; }
+	const GLuint* Indices(GLuint mesh) const { return (const GLuint*)(file.Data() + meshes[mesh].indexOffset); }
+	GLuint IndexCount(GLuint mesh) const { return meshes[mesh].indexCount; }
+
+	GLuint TextureCount(GLuint mesh) const { return meshes[mesh].textureCount; }
+	const char* TextureType(GLuint mesh, GLuint i) const { return strings + textures[meshes[mesh].firstTexture + i].typeOffset; }
+	const char* TexturePath(GLuint mesh, GLuint i) const { return strings + textures[meshes[mesh].firstTexture + i].pathOffset; }
+
+	//Writes imported meshes (which must still hold their vertex/index data) to a cache file
+	static bool Write(const std::string& cachePath, const std::string& sourcePath, const vector<Mesh>& sourceMeshes) {
+		Header h;
+		std::memcpy(h.magic, "GMSH", 4);
+		h.version = MESH_CACHE_VERSION;
+		h.vertexSize = sizeof(Vertex);
+		h.meshCount = (uint32_t)sourceMeshes.size();
+		h.textureCount = 0;
+		if (!Cache::GetFileStamp(sourcePath, h.sourceSize, h.sourceTime))
+			return false;
+
+		//build the dependency, texture and string tables
+		vector<DependencyEntry> dependencies;
+		vector<TextureEntry> textureEntries;
+		std::string stringTable;
+		vector<std::string> libraries = materialLibraries(sourcePath);
+		for (GLuint i = 0; i < libraries.size(); i++) {
+			DependencyEntry entry;
+			entry.pathOffset = (uint32_t)stringTable.size();
+			entry.padding = 0;
+			stringTable.append(libraries[i].c_str(), libraries[i].size() + 1);
+			dependencyStamp(directoryOf(sourcePath) + libraries[i], entry.size, entry.time);
+			dependencies.push_back(entry);
+		}
+		for (GLuint i = 0; i < sourceMeshes.size(); i++) {
+			for (GLuint j = 0; j < sourceMeshes[i].textures.size(); j++) {
+				const Texture& texture = sourceMeshes[i].textures[j];
+				TextureEntry entry;
+				entry.typeOffset = (uint32_t)stringTable.size();
+				stringTable.append(texture.type.c_str(), texture.type.size() + 1);
+				entry.pathOffset = (uint32_t)stringTable.size();
+				stringTable.append(texture.path.C_Str(), texture.path.length + 1);
+				textureEntries.push_back(entry);
+			}
+		}
+		//keep the table non-empty so it is always null terminated
+		stringTable.push_back('\0');
+		h.textureCount = (uint32_t)textureEntries.size();
+		h.dependencyCount = (uint32_t)dependencies.size();
+		h.stringsSize = (uint32_t)stringTable.size();
+
+		//lay out the blobs after the tables
+		vector<MeshEntry> entries(sourceMeshes.size());
+		size_t tablesSize = sizeof(Header) + entries.size() * sizeof(MeshEntry) + dependencies.size() * sizeof(DependencyEntry)
+			+ textureEntries.size() * sizeof(TextureEntry) + stringTable.size();
+		size_t offset = align(tablesSize);
+		GLuint firstTexture = 0;
+		for (GLuint i = 0; i < sourceMeshes.size(); i++) {
+			const Mesh& mesh = sourceMeshes[i];
+			entries[i].vertexCount = (uint32_t)mesh.vertices.size();
+			entries[i].indexCount = (uint32_t)mesh.indices.size();
+			entries[i].firstTexture = firstTexture;
+			entries[i].textureCount = (uint32_t)mesh.textures.size();
+			firstTexture += entries[i].textureCount;
+			entries[i].vertexOffset = offset;
+			offset = align(offset + mesh.vertices.size() * sizeof(Vertex));
+			entries[i].indexOffset = offset;
+			offset = align(offset + mesh.indices.size() * sizeof(GLuint));
+		}
+
+		//write to a temporary file first so an interrupted write never leaves a truncated cache behind
+		std::string tempPath = cachePath + ".tmp";
+		std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		const char zeros[MESH_CACHE_ALIGNMENT] = { 0 };
+		out.write((const char*)&h, sizeof(Header));
+		if (!entries.empty())
+			out.write((const char*)&entries[0], entries.size() * sizeof(MeshEntry));
+		if (!dependencies.empty())
+			out.write((const char*)&dependencies[0], dependencies.size() * sizeof(DependencyEntry));
+		if (!textureEntries.empty())
+			out.write((const char*)&textureEntries[0], textureEntries.size() * sizeof(TextureEntry));
+		out.write(stringTable.data(), stringTable.size());
+		size_t written = tablesSize;
+		for (GLuint i = 0; i < sourceMeshes.size(); i++) {
+			const Mesh& mesh = sourceMeshes[i];
+			out.write(zeros, entries[i].vertexOffset - written);
+			if (!mesh.vertices.empty())
+				out.write((const char*)&mesh.vertices[0], mesh.vertices.size() * sizeof(Vertex));
+			written = entries[i].vertexOffset + mesh.vertices.size() * sizeof(Vertex);
+			out.write(zeros, entries[i].indexOffset - written);
+			if (!mesh.indices.empty())
+				out.write((const char*)&mesh.indices[0], mesh.indices.size() * sizeof(GLuint));
+			written = entries[i].indexOffset + mesh.indices.size() * sizeof(GLuint);
+		}
+		out.close();
+		if (!out)
+			return false;
+		std::remove(cachePath.c_str());
+		return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+	}
+};
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <cfloat>
 using namespace std;
 // GL Includes
 #include <glad/glad.h>
@@ -17,6 +18,11 @@ using namespace std;
 #include <assimp/postprocess.h>
 
 #include <mesh.hpp>
+#include <meshcache.hpp>
+#include <vertexcache.hpp>
+#include <geometrybuffer.hpp>
+#include <textureloader.hpp>
+#include <texturecache.hpp>
 
 GLint TextureFromFile(const char* path, string directory, bool gamma = false);
 
@@ -24,30 +30,259 @@ class Model
 {
 public:
 	/*  Model Data */
-	vector<Texture> textures_loaded;	// Stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
 	vector<Mesh> meshes;
 	string directory;
 	bool gammaCorrection;
+	// Shared vertex/index buffer of all meshes, in the layout picked from the attributes the passes consume
+	GeometryBuffer geometry;
+
+	// Meshes using the same textures are drawn together with one multi-draw call
+	struct Material {
+		vector<Texture> textures;
+		// Sampler uniform of each texture, named when the material is created so drawing doesn't allocate
+		vector<string> samplerNames;
+		GLuint firstCommand;
+		GLuint commandCount;
+	};
+	vector<Material> materials;
+	// Object-space bounding box of all meshes
+	glm::vec3 boundsMin, boundsMax;
+	// Draw record of each mesh, in mesh order, for building culled draws
+	vector<DrawCommand> meshCommands;
 
 	/*  Functions   */
 	// Constructor, expects a filepath to a 3D model.
-	Model(string const & path, bool gamma = false) : gammaCorrection(gamma)
+	// vertexAttributes lists the VERTEX_* attributes read by the shaders drawing this model, add VERTEX_PACKED to quantize them.
+	Model(string const & path, bool gamma = false, GLuint vertexAttributes = VERTEX_ALL) : gammaCorrection(gamma), geometry(VertexLayout(vertexAttributes)), textureLoader(NULL)
 	{
 		this->loadModel(path);
 	}
 
-	// Draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	// Releases this model's references to the shared textures
+	~Model()
+	{
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+			for (GLuint j = 0; j < this->meshes[i].textures.size(); j++)
+				TextureCache::Instance().Release(this->directory + '/' + this->meshes[i].textures[j].path.C_Str(), this->gammaCorrection);
+	}
+
+	// Draws the model, and thus all its meshes, with one multi-draw call per material.
+	// The draws are split per material because materials differ only in their textures, which are bound in between:
+	// the textures have different sizes, so they can't be put in one array and indexed per draw in GL 4.3.
+	void Draw(Shader& shader)
+	{
+		// Tell the vertex shader how the normals are stored
+		shader.SetInt("octahedralNormals", this->geometry.layout.Packed());
+		this->geometry.Bind();
+		for (GLuint i = 0; i < this->materials.size(); i++)
+		{
+			this->bindTextures(shader, this->materials[i]);
+			this->geometry.Draw(this->materials[i].firstCommand, this->materials[i].commandCount);
+		}
+	}
+
+	// Draws only the geometry, for depth passes: no textures or material uniforms, a single multi-draw call.
+	// With several instances every mesh is drawn that many times, the shaders tell them apart by gl_InstanceID.
+	void DrawDepth(GLuint instances = 1)
+	{
+		this->geometry.BindDepth();
+		if (instances == 1)
+		{
+			this->geometry.Draw(0, this->geometry.CommandCount());
+			return;
+		}
+		this->visibleCommands.assign(this->meshCommands.begin(), this->meshCommands.end());
+		for (GLuint i = 0; i < this->visibleCommands.size(); i++)
+			this->visibleCommands[i].instanceCount = instances;
+		this->geometry.DrawDynamic(this->visibleCommands.data(), this->visibleCommands.size());
+	}
+
+	// Draws the meshes whose bounding box overlaps a clip-space frustum, for depth passes. Returns the number of meshes drawn.
+	GLuint DrawDepthCulled(const glm::mat4& modelViewProjection)
 	{
+		this->visibleCommands.clear();
 		for (GLuint i = 0; i < this->meshes.size(); i++)
-			this->meshes[i].Draw(shader);
+			if (!outsideFrustum(modelViewProjection, this->meshes[i].boundsMin, this->meshes[i].boundsMax))
+				this->visibleCommands.push_back(this->meshCommands[i]);
+		this->geometry.BindDepth();
+		this->geometry.DrawDynamic(this->visibleCommands.data(), this->visibleCommands.size());
+		return this->visibleCommands.size();
+	}
+
+	// Bounding box of the model transformed by a model matrix
+	void WorldBounds(const glm::mat4& model, glm::vec3& worldMin, glm::vec3& worldMax) const
+	{
+		worldMin = glm::vec3(FLT_MAX);
+		worldMax = glm::vec3(-FLT_MAX);
+		for (GLuint i = 0; i < 8; i++)
+		{
+			glm::vec3 corner(i & 1 ? this->boundsMax.x : this->boundsMin.x, i & 2 ? this->boundsMax.y : this->boundsMin.y, i & 4 ? this->boundsMax.z : this->boundsMin.z);
+			glm::vec3 world = glm::vec3(model * glm::vec4(corner, 1.0f));
+			worldMin = glm::min(worldMin, world);
+			worldMax = glm::max(worldMax, world);
+		}
 	}
 
 private:
+	// Decodes textures in the background while the model is loading
+	TextureLoader* textureLoader;
+
+	// Vertex counts and simulated vertex shader invocations of the imported meshes, before and after optimization
+	struct ImportStats {
+		GLuint triangles;
+		GLuint verticesBefore, verticesAfter;
+		GLuint missesBefore, missesAfter;
+	} importStats;
+
+	// Draw records of the meshes that passed culling, reserved up front so drawing doesn't allocate
+	vector<DrawCommand> visibleCommands;
+
+	// True if all corners of a box are beyond the same clip plane
+	static bool outsideFrustum(const glm::mat4& modelViewProjection, glm::vec3 boxMin, glm::vec3 boxMax)
+	{
+		GLuint outside[6] = { 0, 0, 0, 0, 0, 0 };
+		for (GLuint i = 0; i < 8; i++)
+		{
+			glm::vec4 clip = modelViewProjection * glm::vec4(i & 1 ? boxMax.x : boxMin.x, i & 2 ? boxMax.y : boxMin.y, i & 4 ? boxMax.z : boxMin.z, 1.0f);
+			outside[0] += clip.x < -clip.w;
+			outside[1] += clip.x > clip.w;
+			outside[2] += clip.y < -clip.w;
+			outside[3] += clip.y > clip.w;
+			outside[4] += clip.z < -clip.w;
+			outside[5] += clip.z > clip.w;
+		}
+		for (GLuint p = 0; p < 6; p++)
+			if (outside[p] == 8)
+				return true;
+		return false;
+	}
+
+	// Models hold texture references, so they can't be copied
+	Model(const Model&);
+	Model& operator=(const Model&);
+
 	/*  Functions   */
-	// Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+	// Loads a model and its textures
 	void loadModel(string path)
 	{
+		// Textures are decoded on worker threads while the meshes are being built
+		TextureLoader loader;
+		this->textureLoader = &loader;
+		this->loadMeshes(path);
+		this->setupDraws();
+		// Upload the decoded textures on this (the GL) thread
+		loader.Finish();
+		this->textureLoader = NULL;
+	}
+
+	// Groups the meshes by material and builds the indirect draw records, sorted by material
+	void setupDraws()
+	{
+		this->boundsMin = this->boundsMax = glm::vec3(0.0f);
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			this->boundsMin = i == 0 ? this->meshes[i].boundsMin : glm::min(this->boundsMin, this->meshes[i].boundsMin);
+			this->boundsMax = i == 0 ? this->meshes[i].boundsMax : glm::max(this->boundsMax, this->meshes[i].boundsMax);
+		}
+
+		map<vector<GLuint>, GLuint> materialIndices;
+		vector<vector<GLuint> > materialMeshes;
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			// Materials are identified by their list of textures
+			vector<GLuint> key;
+			for (GLuint j = 0; j < this->meshes[i].textures.size(); j++)
+				key.push_back(this->meshes[i].textures[j].id);
+			map<vector<GLuint>, GLuint>::iterator it = materialIndices.find(key);
+			if (it == materialIndices.end())
+			{
+				it = materialIndices.insert(make_pair(key, (GLuint)this->materials.size())).first;
+				Material material;
+				material.textures = this->meshes[i].textures;
+				material.samplerNames = this->samplerNames(material.textures);
+				this->materials.push_back(material);
+				materialMeshes.push_back(vector<GLuint>());
+			}
+			this->meshes[i].material = it->second;
+			materialMeshes[it->second].push_back(i);
+		}
+
+		vector<DrawCommand> commands;
+		this->meshCommands.resize(this->meshes.size());
+		this->visibleCommands.reserve(this->meshes.size());
+		for (GLuint m = 0; m < this->materials.size(); m++)
+		{
+			this->materials[m].firstCommand = commands.size();
+			this->materials[m].commandCount = materialMeshes[m].size();
+			for (GLuint i = 0; i < materialMeshes[m].size(); i++)
+			{
+				const Mesh& mesh = this->meshes[materialMeshes[m][i]];
+				DrawCommand command;
+				command.count = mesh.indexCount;
+				command.instanceCount = 1;
+				command.firstIndex = mesh.firstIndex;
+				command.baseVertex = mesh.baseVertex;
+				command.baseInstance = 0;
+				commands.push_back(command);
+				this->meshCommands[materialMeshes[m][i]] = command;
+			}
+		}
+		this->geometry.SetCommands(commands);
+	}
+
+	// Names the sampler of each texture after its type (texture_diffuseN, texture_specularN, ...)
+	vector<string> samplerNames(const vector<Texture>& textures)
+	{
+		vector<string> names;
+		GLuint diffuseNr = 1;
+		GLuint specularNr = 1;
+		GLuint normalNr = 1;
+		GLuint heightNr = 1;
+		for (GLuint i = 0; i < textures.size(); i++)
+		{
+			// Retrieve texture number (the N in diffuse_textureN)
+			stringstream ss;
+			string number;
+			string name = textures[i].type;
+			if (name == "texture_diffuse")
+				ss << diffuseNr++; // Transfer GLuint to stream
+			else if (name == "texture_specular")
+				ss << specularNr++; // Transfer GLuint to stream
+			else if (name == "texture_normal")
+				ss << normalNr++; // Transfer GLuint to stream
+			else if (name == "texture_height")
+				ss << heightNr++; // Transfer GLuint to stream
+			number = ss.str();
+			names.push_back(name + number);
+		}
+		return names;
+	}
+
+	// Binds a material's textures to their samplers
+	void bindTextures(Shader& shader, const Material& material)
+	{
+		for (GLuint i = 0; i < material.textures.size(); i++)
+		{
+			//Modified:
+			//Texture unit 0 is reserved for bufferDepthCompare, so mesh textures start at 1
+			// Now set the sampler to the correct texture unit
+			shader.SetInt(material.samplerNames[i].c_str(), 1 + i);
+			// And finally bind the texture
+			GLState::BindTexture(1 + i, GL_TEXTURE_2D, material.textures[i].id);
+		}
+	}
+
+	// Loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+	void loadMeshes(string path)
+	{
+		// Retrieve the directory path of the filepath
+		this->directory = path.substr(0, path.find_last_of('/'));
+
+		// Warm start: upload meshes straight from the binary cache if it is up to date
+		string cachePath = Cache::GetPath("meshes", Cache::ToHex(Cache::Hash(path)) + ".meshcache");
+		if (this->loadCache(cachePath, path))
+			return;
+
 		// Read file via ASSIMP
 		Assimp::Importer importer;
 		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
@@ -57,11 +292,60 @@ private:
 			cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
 			return;
 		}
-		// Retrieve the directory path of the filepath
-		this->directory = path.substr(0, path.find_last_of('/'));
 
 		// Process ASSIMP's root node recursively
+		memset(&this->importStats, 0, sizeof(ImportStats));
 		this->processNode(scene->mRootNode, scene);
+		if (this->importStats.triangles > 0)
+		{
+			float triangles = (float)this->importStats.triangles;
+			cout << "Optimized " << path << ": " << this->importStats.verticesBefore << " -> " << this->importStats.verticesAfter << " vertices, ACMR "
+				<< this->importStats.missesBefore / triangles << " -> " << this->importStats.missesAfter / triangles << endl;
+		}
+
+		// Pack all meshes into the shared geometry buffer
+		GLuint numVertices = 0, numIndices = 0;
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			numVertices += this->meshes[i].vertexCount;
+			numIndices += this->meshes[i].indexCount;
+		}
+		this->geometry.Allocate(numVertices, numIndices);
+		for (GLuint i = 0; i < this->meshes.size(); i++)
+		{
+			this->meshes[i].ComputeBounds(this->meshes[i].vertices.data());
+			this->geometry.Append(this->meshes[i].vertices.data(), this->meshes[i].indices.data(), this->meshes[i]);
+		}
+
+		// Store the imported meshes for the next launch
+		if (!MeshCache::Write(cachePath, path, this->meshes))
+			cout << "WARNING::MESHCACHE:: could not write " << cachePath << endl;
+	}
+
+	// Creates the meshes from the binary mesh cache. Returns false if the cache is missing or stale.
+	bool loadCache(string const & cachePath, string const & path)
+	{
+		MeshCache cache(cachePath, path);
+		if (!cache.IsValid())
+			return false;
+		GLuint numVertices = 0, numIndices = 0;
+		for (GLuint i = 0; i < cache.MeshCount(); i++)
+		{
+			numVertices += cache.VertexCount(i);
+			numIndices += cache.IndexCount(i);
+		}
+		this->geometry.Allocate(numVertices, numIndices);
+		for (GLuint i = 0; i < cache.MeshCount(); i++)
+		{
+			vector<Texture> textures;
+			for (GLuint j = 0; j < cache.TextureCount(i); j++)
+				textures.push_back(this->loadTexture(cache.TexturePath(i, j), cache.TextureType(i, j)));
+			Mesh mesh(cache.VertexCount(i), cache.IndexCount(i), textures);
+			mesh.ComputeBounds(cache.Vertices(i));
+			this->geometry.Append(cache.Vertices(i), cache.Indices(i), mesh);
+			this->meshes.push_back(mesh);
+		}
+		return true;
 	}
 
 	// Processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
@@ -124,6 +408,8 @@ private:
 				vector.z = mesh->mTangents[i].z;
 				vertex.Tangent = vector;
 			}
+			else
+				vertex.Tangent = glm::vec3(0.0f); // Welding compares whole vertices, so nothing may be left uninitialized
 			if (mesh->mBitangents) {
 				// Bitangent
 				vector.x = mesh->mBitangents[i].x;
@@ -131,6 +417,8 @@ private:
 				vector.z = mesh->mBitangents[i].z;
 				vertex.Bitangent = vector;
 			}
+			else
+				vertex.Bitangent = glm::vec3(0.0f);
 			vertices.push_back(vertex);
 		}
 		// Now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
@@ -166,10 +454,27 @@ private:
 			textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 		}
 
+		this->optimizeMesh(vertices, indices);
+
 		// Return a mesh object created from the extracted mesh data
 		return Mesh(vertices, indices, textures);
 	}
 
+	// Welds identical vertices, reorders the triangles for the post-transform vertex cache and the vertices for fetch locality
+	void optimizeMesh(vector<Vertex>& vertices, vector<GLuint>& indices)
+	{
+		this->importStats.triangles += indices.size() / 3;
+		this->importStats.verticesBefore += vertices.size();
+		this->importStats.missesBefore += VertexCacheOptimizer::CacheMisses(indices, vertices.size());
+
+		VertexCacheOptimizer::Weld(vertices, indices);
+		VertexCacheOptimizer::OptimizeTriangleOrder(indices, vertices.size());
+		VertexCacheOptimizer::OptimizeVertexOrder(vertices, indices);
+
+		this->importStats.verticesAfter += vertices.size();
+		this->importStats.missesAfter += VertexCacheOptimizer::CacheMisses(indices, vertices.size());
+	}
+
 	// Checks all material textures of a given type and loads the textures if they're not loaded yet.
 	// The required info is returned as a Texture struct.
 	vector<Texture> loadMaterialTextures(aiMaterial* mat, aiTextureType type, string typeName)
@@ -179,29 +484,20 @@ private:
 		{
 			aiString str;
 			mat->GetTexture(type, i, &str);
-			// Check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-			GLboolean skip = false;
-			for (GLuint j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.C_Str(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true; // A texture with the same filepath has already been loaded, continue to next one. (optimization)
-					break;
-				}
-			}
-			if (!skip)
-			{   // If texture hasn't been loaded already, load it
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str;
-				textures.push_back(texture);
-				this->textures_loaded.push_back(texture);  // Store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-			}
+			textures.push_back(this->loadTexture(str.C_Str(), typeName));
 		}
 		return textures;
 	}
+
+	// Resolves a texture through the shared texture cache, so it is only loaded once per process
+	Texture loadTexture(const char* path, string typeName)
+	{
+		Texture texture;
+		texture.id = TextureCache::Instance().Acquire(this->directory + '/' + path, this->gammaCorrection, *this->textureLoader);
+		texture.type = typeName;
+		texture.path = aiString(path);
+		return texture;
+	}
 };
 
 
@@ -217,16 +513,7 @@ GLint TextureFromFile(const char* path, string directory, bool gamma)
 	int width, height;
 	unsigned char* image = SOIL_load_image(filename.c_str(), &width, &height, 0, SOIL_LOAD_RGB);
 	// Assign texture to ID
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glTexImage2D(GL_TEXTURE_2D, 0, gamma ? GL_SRGB : GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	// Parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	TextureLoader::Upload(textureID, image, width, height, gamma);
 	SOIL_free_image_data(image);
 	return textureID;
 }
\ No newline at end of file
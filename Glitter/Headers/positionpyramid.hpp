@@ -0,0 +1,67 @@
+#pragma once
+#include "glitter.hpp"
+#include "shader.hpp"
+#include "gbuffer.hpp"
+#include <algorithm>
+
+//MIP levels of the position pyramid, level 0 is the G-buffer's own position texture
+#ifndef POSITION_PYRAMID_LEVELS
+#define POSITION_PYRAMID_LEVELS 5
+#endif
+//compute work group size of the pyramid build
+#ifndef POSITION_PYRAMID_GROUP
+#define POSITION_PYRAMID_GROUP 8
+#endif
+
+//Camera-space position MIP pyramid of all G-buffer layers (as in Scalable Ambient Obscurance), rebuilt every frame.
+//Each level keeps one of every 2x2 positions of the level above instead of averaging across edges,
+//so distant AO taps can read coarse levels and stay in cache. Level 0 isn't copied, samples read it from the
+//G-buffer, so the texture only stores levels 1 and up (its mip i is pyramid level i + 1).
+class PositionPyramid {
+private:
+	GLuint texture;
+
+	PositionPyramid(const PositionPyramid&);
+	PositionPyramid& operator=(const PositionPyramid&);
+
+public:
+	PositionPyramid() {
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		//image stores need a four channel format
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, POSITION_PYRAMID_LEVELS - 1, GL_RGBA16F, std::max(1, mWidth >> 1), std::max(1, mHeight >> 1), GBUFFER_LAYERS);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, POSITION_PYRAMID_LEVELS - 2);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	}
+
+	//Builds the coarser levels from this frame's G-buffer positions
+	void Build(Shader& mipShader, GBuffer& gbuffer) {
+		mipShader.Use();
+		mipShader.SetInt("destination", 0);
+		//level 1 reads the G-buffer, the coarser levels read the one above
+		gbuffer.BindBuffersPositionPyramid(mipShader);
+		mipShader.SetInt("sourceLevel", 0);
+		for (GLint level = 1; level < POSITION_PYRAMID_LEVELS; level++) {
+			if (level == 2) {
+				GLState::BindTexture(0, GL_TEXTURE_2D_ARRAY, texture);
+				mipShader.SetInt("source", 0);
+			}
+			if (level >= 2)
+				mipShader.SetInt("sourceLevel", level - 2);
+			glBindImageTexture(0, texture, level - 1, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+			GLuint width = std::max(1, mWidth >> level);
+			GLuint height = std::max(1, mHeight >> level);
+			glDispatchCompute((width + POSITION_PYRAMID_GROUP - 1) / POSITION_PYRAMID_GROUP, (height + POSITION_PYRAMID_GROUP - 1) / POSITION_PYRAMID_GROUP, GBUFFER_LAYERS);
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		}
+	}
+
+	void BindBuffersSSAO(Shader& ssaoShader) {
+		GLState::BindTexture(3, GL_TEXTURE_2D_ARRAY, texture);
+		ssaoShader.SetInt("bufferPositionMips", 3);
+	}
+};
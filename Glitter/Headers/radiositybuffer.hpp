@@ -6,9 +6,14 @@
 #include <vector>
 using std::vector;
 
-#define RADIOSITY_NUM_SAMPLES 32
-
-//Single-scatter radiosity
+//few samples per frame, RadiosityHistory accumulates them over frames
+#ifndef RADIOSITY_NUM_SAMPLES
+#define RADIOSITY_NUM_SAMPLES 8
+#endif
+//uniform buffer binding point of the sample kernel
+#define RADIOSITY_KERNEL_BINDING 1
+
+//Radiosity, single-scatter per frame with further bounces fed back from RadiosityHistory
 class RadiosityBuffer {
 private:
 	//frame buffer
@@ -16,11 +21,11 @@ private:
 	//inputs
 	GLuint bufferRadiosity;
 	GLuint bufferColor;
-	//outputs
-	//GLuint bufferBounceRadiosityOut;
 
 	//samples
 	vector<glm::vec3> samples;
+	//samples in a std140 uniform buffer, uploaded once
+	GLuint kernelUBO;
 	GLuint noiseTexture;
 public:
 	RadiosityBuffer() {
@@ -45,6 +50,15 @@ public:
 			samples.push_back(sample);
 		}
 
+		//upload the kernel, std140 pads vec3 array elements to 16 bytes
+		vector<glm::vec4> kernel;
+		for (GLuint i = 0; i < RADIOSITY_NUM_SAMPLES; i++)
+			kernel.push_back(glm::vec4(samples[i], 0.0f));
+		glGenBuffers(1, &kernelUBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, kernelUBO);
+		glBufferData(GL_UNIFORM_BUFFER, kernel.size() * sizeof(glm::vec4), &kernel[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
 		//create noise texture
 		vector<glm::vec3> noise;
 		for (GLuint i = 0; i < 16; i++) {
@@ -88,44 +102,35 @@ public:
 	}
 
 	void BindFramebuffer() {
-		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, FBO);
 	}
 
 	void BindBuffersRadiosity(Shader& radiosityShader, GBuffer& gbuffer) {
 		gbuffer.BindBuffersRadiosity(radiosityShader);
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, noiseTexture);
-		glUniform1i(glGetUniformLocation(radiosityShader.Program, "texNoise"), 2);
-		glActiveTexture(GL_TEXTURE3);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferRadiosity);
-		glUniform1i(glGetUniformLocation(radiosityShader.Program, "bufferRadiosity"), 3);
+		GLState::BindTexture(2, GL_TEXTURE_2D, noiseTexture);
+		radiosityShader.SetInt("texNoise", 2);
+		GLState::BindTexture(3, GL_TEXTURE_2D_ARRAY, bufferRadiosity);
+		radiosityShader.SetInt("bufferRadiosity", 3);
 		//glActiveTexture(GL_TEXTURE4);
 		//glBindTexture(GL_TEXTURE_2D_ARRAY, bufferColor);
 		//glUniform1i(glGetUniformLocation(radiosityShader.Program, "bufferColor"), 4);
 	}
 
 	void BindBuffersBlur(Shader& blurRadiosityShader) {
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D_ARRAY, bufferColor);
-		glUniform1i(glGetUniformLocation(blurRadiosityShader.Program, "bufferColor"), 1);
+		GLState::BindTexture(1, GL_TEXTURE_2D_ARRAY, bufferColor);
+		blurRadiosityShader.SetInt("bufferColor", 1);
 	}
 
-	void SetUniforms(Shader& ssaoShader) {
-		//samples
-		for (GLuint i = 0; i < RADIOSITY_NUM_SAMPLES; i++)
-			glUniform3fv(glGetUniformLocation(ssaoShader.Program, ("samples[" + std::to_string(i) + "]").c_str()), 1, &samples[i][0]);
+	//Binds the sample kernel to its uniform block binding point
+	void BindKernel() {
+		glBindBufferBase(GL_UNIFORM_BUFFER, RADIOSITY_KERNEL_BINDING, kernelUBO);
 	}
 
-	/*void CopyOutputsToInputs() {
-
-	}*/
-
 	/*void BindBuffersLighting(Shader& lightingShader, GBuffer& gbuffer) {
 		//bind necessary textures from gbuffer
 		gbuffer.BindBuffersLighting(lightingShader);
 		//as well as output from SSAO shader
-		glActiveTexture(GL_TEXTURE6);
-		glBindTexture(GL_TEXTURE_2D, bufferBlurColor);
-		glUniform1i(glGetUniformLocation(lightingShader.Program, "bufferOcclusion"), 6);
+		GLState::BindTexture(6, GL_TEXTURE_2D, bufferBlurColor);
+		lightingShader.SetInt("bufferOcclusion", 6);
 	}*/
 };
\ No newline at end of file
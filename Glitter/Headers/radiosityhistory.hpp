@@ -0,0 +1,99 @@
+#pragma once
+#include "glitter.hpp"
+#include "shader.hpp"
+#include "gbuffer.hpp"
+
+//work group size of radiosityTemporal.comp.glsl in each dimension
+#ifndef TEMPORAL_GROUP
+#define TEMPORAL_GROUP 8
+#endif
+
+//Temporal accumulation of the radiosity pass output, at its reduced resolution.
+//Each frame reprojects the previous frame's result with the camera matrices and blends it with the new, noisy
+//result by their confidences. History is dropped where the reprojected depth doesn't match (disocclusion).
+//The radiosity pass also reads the previous result as incoming light, so each frame adds a bounce.
+class RadiosityHistory {
+private:
+	//ping-pong of accumulated radiosity (rgb) with its accumulated confidence (a), and the linear depth it was computed at
+	GLuint color[2];
+	GLuint depth[2];
+	//index of the textures written last frame
+	GLuint current;
+	//whether last frame's textures hold a result
+	bool valid;
+	glm::mat4 prevView;
+	glm::mat4 prevProjection;
+
+	RadiosityHistory(const RadiosityHistory&);
+	RadiosityHistory& operator=(const RadiosityHistory&);
+
+	static GLuint createTexture(GLenum format, GLenum filter) {
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, format, INDIRECT_WIDTH, INDIRECT_HEIGHT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		return texture;
+	}
+
+public:
+	RadiosityHistory() : current(0), valid(false) {
+		for (GLuint i = 0; i < 2; i++) {
+			//reprojected positions fall between texels, radiosity is filtered but depth isn't averaged across edges
+			color[i] = createTexture(GL_RGBA16F, GL_LINEAR);
+			depth[i] = createTexture(GL_R32F, GL_NEAREST);
+		}
+	}
+
+	//Forgets the accumulated radiosity, e.g. when radiosity was off for a while
+	void Invalidate() {
+		valid = false;
+	}
+
+	//Blends the radiosity in unit 0 (see BlurBuffer::BindBuffersTemporal) with last frame's, into the other history textures
+	void Accumulate(Shader& temporalShader, GBuffer& gbuffer, const glm::mat4& view, const glm::mat4& projection) {
+		GLuint next = 1 - current;
+		temporalShader.Use();
+		gbuffer.BindBuffersBlur(temporalShader);
+		temporalShader.SetInt("bufferInput", 0);
+		GLState::BindTexture(3, GL_TEXTURE_2D, color[current]);
+		GLState::BindTexture(4, GL_TEXTURE_2D, depth[current]);
+		temporalShader.SetInt("historyColor", 3);
+		temporalShader.SetInt("historyDepth", 4);
+		temporalShader.SetInt("useHistory", valid);
+		temporalShader.SetMat4("invView", glm::inverse(view));
+		temporalShader.SetMat4("prevView", prevView);
+		temporalShader.SetMat4("prevProjection", prevProjection);
+		temporalShader.SetInt("outputColor", 0);
+		temporalShader.SetInt("outputDepth", 1);
+		glBindImageTexture(0, color[next], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+		glBindImageTexture(1, depth[next], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((INDIRECT_WIDTH + TEMPORAL_GROUP - 1) / TEMPORAL_GROUP, (INDIRECT_HEIGHT + TEMPORAL_GROUP - 1) / TEMPORAL_GROUP, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+		current = next;
+		valid = true;
+		prevView = view;
+		prevProjection = projection;
+	}
+
+	//Binds last frame's radiosity for the radiosity pass to gather as further bounces, before this frame's Accumulate
+	void BindBuffersRadiosity(Shader& radiosityShader, const glm::mat4& view, bool bounces) {
+		GLState::BindTexture(4, GL_TEXTURE_2D, color[current]);
+		GLState::BindTexture(5, GL_TEXTURE_2D, depth[current]);
+		radiosityShader.SetInt("historyColor", 4);
+		radiosityShader.SetInt("historyDepth", 5);
+		radiosityShader.SetInt("useHistory", valid && bounces);
+		radiosityShader.SetMat4("reprojection", prevView * glm::inverse(view));
+		radiosityShader.SetMat4("prevProjection", prevProjection);
+	}
+
+	//Binds the accumulated radiosity as the input of the blur
+	void BindBuffersBlur(Shader& blurShader) {
+		GLState::BindTexture(0, GL_TEXTURE_2D, color[current]);
+		blurShader.SetInt("bufferInput", 0);
+	}
+};
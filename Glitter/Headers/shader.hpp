@@ -2,18 +2,53 @@
 #define SHADER_H
 
 #include <glad\glad.h>
+#include "glstate.hpp"
+#include "cache.hpp"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// Bump whenever the program binary file layout changes
+#define SHADER_BINARY_VERSION 1
+
+// Preprocessor defines a shader is specialized with, injected into every stage after #version
+class ShaderDefines
+{
+public:
+	ShaderDefines& Set(const std::string& name, const std::string& value)
+	{
+		this->defines[name] = value;
+		return *this;
+	}
+	ShaderDefines& Set(const std::string& name, int value) { return Set(name, std::to_string(value)); }
+
+	// The #define lines, sorted by name so equal sets give equal sources
+	std::string Source() const
+	{
+		std::string source;
+		for (std::map<std::string, std::string>::const_iterator it = this->defines.begin(); it != this->defines.end(); ++it)
+			source += "#define " + it->first + " " + it->second + "\n";
+		return source;
+	}
+
+private:
+	std::map<std::string, std::string> defines;
+};
 
 class Shader
 {
 public:
 	GLuint Program;
 	// Constructor generates the shader on the fly
-	Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const GLchar* geometryPath = nullptr)
+	Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const GLchar* geometryPath = nullptr, const ShaderDefines& defines = ShaderDefines())
 	{
 		// 1. Retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
@@ -55,6 +90,19 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
+		// Specialize the sources
+		std::string defineSource = defines.Source();
+		injectDefines(vertexCode, defineSource);
+		injectDefines(fragmentCode, defineSource);
+		if (geometryPath != nullptr)
+			injectDefines(geometryCode, defineSource);
+		// Warm start: restore the linked program the driver handed us last time
+		std::string binaryPath = programBinaryPath(vertexCode, fragmentCode, geometryCode);
+		if (loadProgramBinary(binaryPath))
+		{
+			reflectUniforms();
+			return;
+		}
 		const GLchar* vShaderCode = vertexCode.c_str();
 		const GLchar * fShaderCode = fragmentCode.c_str();
 		// 2. Compile shaders
@@ -87,19 +135,272 @@ public:
 		glAttachShader(this->Program, fragment);
 		if (geometryPath != nullptr)
 			glAttachShader(this->Program, geometry);
+		glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(this->Program);
 		checkCompileErrors(this->Program, "PROGRAM");
+		saveProgramBinary(binaryPath);
 		// Delete the shaders as they're linked into our program now and no longer necessery
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
 		if (geometryPath != nullptr)
 			glDeleteShader(geometry);
+		// Look up every active uniform once, so setting them never asks the driver
+		reflectUniforms();
+	}
+	// Constructor for a compute shader
+	Shader(const GLchar* computePath, const ShaderDefines& defines = ShaderDefines())
+	{
+		std::string computeCode;
+		std::ifstream cShaderFile;
+		cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			cShaderFile.open(computePath);
+			std::stringstream cShaderStream;
+			cShaderStream << cShaderFile.rdbuf();
+			cShaderFile.close();
+			computeCode = cShaderStream.str();
+		}
+		catch (const std::ifstream::failure&)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		}
+		injectDefines(computeCode, defines.Source());
+		std::string binaryPath = programBinaryPath(std::string(), std::string(), std::string(), computeCode);
+		if (loadProgramBinary(binaryPath))
+		{
+			reflectUniforms();
+			return;
+		}
+		const GLchar* cShaderCode = computeCode.c_str();
+		GLuint compute = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute, 1, &cShaderCode, NULL);
+		glCompileShader(compute);
+		checkCompileErrors(compute, "COMPUTE");
+		this->Program = glCreateProgram();
+		glAttachShader(this->Program, compute);
+		glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(this->Program);
+		checkCompileErrors(this->Program, "PROGRAM");
+		saveProgramBinary(binaryPath);
+		glDeleteShader(compute);
+		reflectUniforms();
+	}
 
+	// Returns the permutation of a shader for a define set, compiling it on first use.
+	// Permutations live until the program exits, so fetch them before the frame loop.
+	static Shader& Get(const GLchar* vertexPath, const GLchar* fragmentPath, const GLchar* geometryPath = nullptr, const ShaderDefines& defines = ShaderDefines())
+	{
+		static std::map<std::string, Shader> permutations;
+		std::string key = std::string(vertexPath) + "|" + fragmentPath + "|" + (geometryPath != nullptr ? geometryPath : "") + "|" + defines.Source();
+		std::map<std::string, Shader>::iterator it = permutations.find(key);
+		if (it == permutations.end())
+			it = permutations.insert(std::make_pair(key, Shader(vertexPath, fragmentPath, geometryPath, defines))).first;
+		return it->second;
 	}
+
 	// Uses the current shader
-	void Use() { glUseProgram(this->Program); }
+	void Use() { GLState::UseProgram(this->Program); }
+
+	// Location of an active uniform, -1 if the program doesn't use it. Array elements are listed individually ("samples[3]").
+	GLint GetUniformLocation(const GLchar* name) const
+	{
+		std::vector<Uniform>::const_iterator it = std::lower_bound(this->uniforms.begin(), this->uniforms.end(), name, compareUniform);
+		if (it == this->uniforms.end() || std::strcmp(it->name.c_str(), name) != 0)
+			return -1;
+		return it->location;
+	}
+
+	// Assigns a uniform block to a buffer binding point, only needed once after linking
+	void BindUniformBlock(const GLchar* blockName, GLuint binding)
+	{
+		GLuint index = glGetUniformBlockIndex(this->Program, blockName);
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(this->Program, index, binding);
+	}
+
+	// Assigns a shader storage block to a buffer binding point, only needed once after linking
+	void BindStorageBlock(const GLchar* blockName, GLuint binding)
+	{
+		GLuint index = glGetProgramResourceIndex(this->Program, GL_SHADER_STORAGE_BLOCK, blockName);
+		if (index != GL_INVALID_INDEX)
+			glShaderStorageBlockBinding(this->Program, index, binding);
+	}
+
+	// Typed setters, the shader must be in use
+	void SetInt(const GLchar* name, GLint value) const { glUniform1i(GetUniformLocation(name), value); }
+	void SetFloat(const GLchar* name, GLfloat value) const { glUniform1f(GetUniformLocation(name), value); }
+	void SetVec3(const GLchar* name, const glm::vec3& value) const { glUniform3fv(GetUniformLocation(name), 1, glm::value_ptr(value)); }
+	void SetMat4(const GLchar* name, const glm::mat4& value) const { glUniformMatrix4fv(GetUniformLocation(name), 1, GL_FALSE, glm::value_ptr(value)); }
+	// Array setters start at the named element
+	void SetVec3Array(const GLchar* name, GLsizei count, const glm::vec3* values) const { glUniform3fv(GetUniformLocation(name), count, glm::value_ptr(values[0])); }
+	void SetMat4Array(const GLchar* name, GLsizei count, const glm::mat4* values) const { glUniformMatrix4fv(GetUniformLocation(name), count, GL_FALSE, glm::value_ptr(values[0])); }
 
 private:
+	struct Uniform
+	{
+		std::string name;
+		GLint location;
+	};
+	// Active uniforms sorted by name
+	std::vector<Uniform> uniforms;
+
+	static bool compareUniform(const Uniform& uniform, const GLchar* name) { return std::strcmp(uniform.name.c_str(), name) < 0; }
+	static bool sortUniforms(const Uniform& a, const Uniform& b) { return a.name < b.name; }
+
+	// Inserts the defines after the #version line, and resets the line numbers so compile errors still point at the file
+	static void injectDefines(std::string& code, const std::string& defineSource)
+	{
+		if (defineSource.empty())
+			return;
+		std::string::size_type version = code.find("#version");
+		std::string::size_type lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+		if (lineEnd == std::string::npos)
+		{
+			code = defineSource + code;
+			return;
+		}
+		code.insert(lineEnd + 1, defineSource + "#line 2\n");
+	}
+
+	struct BinaryHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t format;
+		uint32_t length;
+	};
+
+	// Program binaries are keyed by the sources and the driver that compiled them
+	static std::string programBinaryPath(const std::string& vertexCode, const std::string& fragmentCode, const std::string& geometryCode, const std::string& computeCode = std::string())
+	{
+		const std::string* sources[4] = { &vertexCode, &fragmentCode, &geometryCode, &computeCode };
+		uint32_t version = SHADER_BINARY_VERSION;
+		uint64_t hash = Cache::Hash(&version, sizeof(version));
+		for (int i = 0; i < 4; i++)
+		{
+			// Hash the lengths too, so text moving between stages changes the key
+			uint64_t length = sources[i]->size();
+			hash = Cache::Hash(&length, sizeof(length), hash);
+			hash = Cache::Hash(*sources[i], hash);
+		}
+		const GLenum driverStrings[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+		for (int i = 0; i < 3; i++)
+		{
+			const char* driver = (const char*)glGetString(driverStrings[i]);
+			if (driver != NULL)
+				hash = Cache::Hash(driver, std::strlen(driver), hash);
+		}
+		return Cache::GetPath("shaders", Cache::ToHex(hash) + ".bin");
+	}
+
+	static bool programBinarySupported()
+	{
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		return formats > 0;
+	}
+
+	// Creates the program from a cached binary, fails if there is none or the driver rejects it
+	bool loadProgramBinary(const std::string& path)
+	{
+		if (!programBinarySupported())
+			return false;
+		std::ifstream in(path.c_str(), std::ios::binary);
+		BinaryHeader header;
+		if (!in.read((char*)&header, sizeof(BinaryHeader)))
+			return false;
+		if (std::memcmp(header.magic, "GSHB", 4) != 0 || header.version != SHADER_BINARY_VERSION || header.length == 0)
+			return false;
+		std::vector<char> binary(header.length);
+		if (!in.read(&binary[0], header.length))
+			return false;
+		this->Program = glCreateProgram();
+		glProgramBinary(this->Program, header.format, &binary[0], header.length);
+		GLint success;
+		glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+		if (!success)
+		{
+			// e.g. after a driver update, compile from source instead
+			glDeleteProgram(this->Program);
+			this->Program = 0;
+			return false;
+		}
+		return true;
+	}
+
+	void saveProgramBinary(const std::string& path)
+	{
+		GLint success, length = 0;
+		glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+		if (!success || !programBinarySupported())
+			return;
+		glGetProgramiv(this->Program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0)
+			return;
+		std::vector<char> binary(length);
+		GLenum format;
+		glGetProgramBinary(this->Program, length, &length, &format, &binary[0]);
+		BinaryHeader header;
+		std::memcpy(header.magic, "GSHB", 4);
+		header.version = SHADER_BINARY_VERSION;
+		header.format = format;
+		header.length = length;
+
+		// Write to a temporary file first so an interrupted write never leaves a truncated binary behind
+		std::string tempPath = path + ".tmp";
+		std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out)
+			return;
+		out.write((const char*)&header, sizeof(BinaryHeader));
+		out.write(&binary[0], length);
+		out.close();
+		if (!out)
+			return;
+		std::remove(path.c_str());
+		std::rename(tempPath.c_str(), path.c_str());
+	}
+
+	void reflectUniforms()
+	{
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(this->Program, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> buffer(maxLength + 1);
+		for (GLint i = 0; i < count; i++)
+		{
+			GLint size;
+			GLenum type;
+			GLsizei length;
+			glGetActiveUniform(this->Program, i, (GLsizei)buffer.size(), &length, &size, &type, &buffer[0]);
+			std::string name(&buffer[0], length);
+			// Uniform block members have no location
+			GLint location = glGetUniformLocation(this->Program, name.c_str());
+			if (location < 0)
+				continue;
+			// Arrays are reported as "name[0]", register the bare name and every element
+			std::string::size_type bracket = name.rfind("[0]");
+			if (bracket != std::string::npos && bracket + 3 == name.size())
+			{
+				std::string base = name.substr(0, bracket);
+				Uniform uniform = { base, location };
+				this->uniforms.push_back(uniform);
+				for (GLint j = 0; j < size; j++)
+				{
+					std::string element = base + "[" + std::to_string(j) + "]";
+					Uniform elementUniform = { element, glGetUniformLocation(this->Program, element.c_str()) };
+					this->uniforms.push_back(elementUniform);
+				}
+			}
+			else
+			{
+				Uniform uniform = { name, location };
+				this->uniforms.push_back(uniform);
+			}
+		}
+		std::sort(this->uniforms.begin(), this->uniforms.end(), sortUniforms);
+	}
+
 	void checkCompileErrors(GLuint shader, std::string type)
 	{
 		GLint success;
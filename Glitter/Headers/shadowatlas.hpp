@@ -0,0 +1,166 @@
+#pragma once
+#include "glitter.hpp"
+#include "shader.hpp"
+#include "light.hpp"
+#include "glstate.hpp"
+#include <vector>
+
+//shader storage binding point of the shadows being redrawn
+#define SHADOW_BUFFER_BINDING 3
+//texture unit the lighting pass samples the atlas from
+#define SHADOW_ATLAS_UNIT 0
+//cubemaps in the atlas, each is 6 * SHADOW_MAP_RESOLUTION^2 depth texels (24 MiB at 1024), further lights cast no shadows
+#ifndef MAX_SHADOWED_LIGHTS
+#define MAX_SHADOWED_LIGHTS 8
+#endif
+
+//A shadow being redrawn as laid out in the std430 shadow buffer read by the layered depth pass
+struct ShadowData {
+	glm::mat4 faces[6];
+	glm::vec3 lightPos;
+	//first layer-face of the light's cubemap
+	GLint layer;
+};
+
+//The shadow cubemaps of point lights in one cube map array, indexed by Light::ShadowIndex().
+//The atlas has a fixed number of cubemaps and hands them out to lights in the order they are assigned.
+//Shadows are redrawn in batches: Add() clears a light's cubemap and queues it, then all queued lights are
+//drawn at once by an instanced layered pass (instance i draws shadow i), or one face at a time.
+class ShadowAtlas {
+private:
+	GLuint capacity;
+	//cubemaps handed out so far
+	GLuint assigned;
+	GLuint texture;
+	//layered framebuffer over the whole array
+	GLuint atlasFBO;
+	//framebuffer that a single layer-face is attached to
+	GLuint faceFBO;
+	//a cube map view and framebuffer per light, so clearing a light's shadow leaves the others cached
+	std::vector<GLuint> views;
+	std::vector<GLuint> clearFBOs;
+	//shadows queued this frame
+	std::vector<ShadowData> pending;
+	GLuint shadowBuffer;
+
+	ShadowAtlas(const ShadowAtlas&);
+	ShadowAtlas& operator=(const ShadowAtlas&);
+
+public:
+	ShadowAtlas(GLuint capacity = MAX_SHADOWED_LIGHTS) : capacity(capacity), assigned(0), views(capacity), clearFBOs(capacity) {
+		pending.reserve(capacity);
+
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, texture);
+		glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 1, GL_DEPTH_COMPONENT24, SHADOW_MAP_RESOLUTION, SHADOW_MAP_RESOLUTION, 6 * capacity);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+		glGenFramebuffers(1, &atlasFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, atlasFBO);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "Shadow atlas framebuffer not complete!" << std::endl;
+
+		glGenFramebuffers(1, &faceFBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, faceFBO);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+
+		glGenTextures(capacity, &views[0]);
+		glGenFramebuffers(capacity, &clearFBOs[0]);
+		for (GLuint i = 0; i < capacity; i++) {
+			glTextureView(views[i], GL_TEXTURE_CUBE_MAP, texture, GL_DEPTH_COMPONENT24, 0, 1, 6 * i, 6);
+			glBindFramebuffer(GL_FRAMEBUFFER, clearFBOs[i]);
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, views[i], 0);
+			glDrawBuffer(GL_NONE);
+			glReadBuffer(GL_NONE);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		glGenBuffers(1, &shadowBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, shadowBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(ShadowData), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	GLuint Capacity() const {
+		return capacity;
+	}
+
+	//Gives a light a cubemap if one is free. Returns false when the atlas is full, the light then casts no shadow.
+	bool Assign(Light& light) {
+		if (light.ShadowIndex() >= 0)
+			return true;
+		if (assigned == capacity)
+			return false;
+		light.SetShadowIndex(assigned++);
+		return true;
+	}
+
+	//Forgets the shadows queued last frame
+	void Begin() {
+		pending.clear();
+	}
+
+	//Clears a light's cubemap and queues it for drawing, the light must have begun its shadow.
+	//Returns false if the light wasn't assigned a cubemap.
+	bool Add(const Light& light) {
+		if (light.ShadowIndex() < 0)
+			return false;
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, clearFBOs[light.ShadowIndex()]);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		ShadowData data;
+		for (GLuint face = 0; face < 6; face++)
+			data.faces[face] = light.ShadowTransform(face);
+		data.lightPos = light.position;
+		data.layer = 6 * light.ShadowIndex();
+		pending.push_back(data);
+		return true;
+	}
+
+	//Number of shadows queued, the instance count of the layered pass
+	GLuint Pending() const {
+		return pending.size();
+	}
+
+	//Binds the whole array for the layered pass and uploads the queued shadows
+	void BindLayered(Shader& depthShader, const glm::mat4& model) {
+		glViewport(0, 0, SHADOW_MAP_RESOLUTION, SHADOW_MAP_RESOLUTION);
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, atlasFBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, shadowBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, pending.size() * sizeof(ShadowData), pending.data());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SHADOW_BUFFER_BINDING, shadowBuffer);
+		depthShader.Use();
+		depthShader.SetFloat("farPlane", mFar);
+		depthShader.SetMat4("model", model);
+	}
+
+	//Binds one face of a queued shadow, for drawing the faces one at a time
+	void BindFace(Shader& faceShader, GLuint shadow, GLuint face, const glm::mat4& model) {
+		glViewport(0, 0, SHADOW_MAP_RESOLUTION, SHADOW_MAP_RESOLUTION);
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, faceFBO);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, pending[shadow].layer + face);
+		faceShader.Use();
+		faceShader.SetFloat("farPlane", mFar);
+		faceShader.SetMat4("model", model);
+		faceShader.SetMat4("shadowMatrix", pending[shadow].faces[face]);
+		faceShader.SetVec3("lightPos", pending[shadow].lightPos);
+	}
+
+	//Light-space transformation of a face of a queued shadow
+	const glm::mat4& FaceTransform(GLuint shadow, GLuint face) const {
+		return pending[shadow].faces[face];
+	}
+
+	//Binds the array for sampling in the lighting pass
+	void BindBuffers(Shader& lightShader) {
+		lightShader.SetInt("shadowAtlas", SHADOW_ATLAS_UNIT);
+		GLState::BindTexture(SHADOW_ATLAS_UNIT, GL_TEXTURE_CUBE_MAP_ARRAY, texture);
+	}
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include "glitter.hpp"
+#include "textureloader.hpp"
+#include <string>
+#include <unordered_map>
+
+//Process-wide cache of GPU textures shared by every Model.
+//Textures are keyed by file path (and color space) and reference counted,
+//so a file used by several materials or models is decoded and uploaded once.
+class TextureCache {
+private:
+	struct Entry {
+		GLuint id;
+		GLuint references;
+	};
+	std::unordered_map<std::string, Entry> textures;
+
+	TextureCache() {}
+	TextureCache(const TextureCache&);
+	TextureCache& operator=(const TextureCache&);
+
+	static std::string key(const std::string& filename, bool gamma) {
+		return gamma ? filename + "|srgb" : filename;
+	}
+
+public:
+	static TextureCache& Instance() {
+		static TextureCache cache;
+		return cache;
+	}
+
+	//Returns the texture for a file and adds a reference to it.
+	//Textures that aren't resident yet are queued on the loader, which must be finished before they are used.
+	GLuint Acquire(const std::string& filename, bool gamma, TextureLoader& loader) {
+		std::unordered_map<std::string, Entry>::iterator it = textures.find(key(filename, gamma));
+		if (it != textures.end()) {
+			it->second.references++;
+			return it->second.id;
+		}
+		Entry entry;
+		entry.id = loader.Load(filename, gamma);
+		entry.references = 1;
+		textures[key(filename, gamma)] = entry;
+		return entry.id;
+	}
+
+	//Drops a reference to a texture, deleting it once no model uses it anymore
+	void Release(const std::string& filename, bool gamma) {
+		std::unordered_map<std::string, Entry>::iterator it = textures.find(key(filename, gamma));
+		if (it == textures.end())
+			return;
+		if (--it->second.references == 0) {
+			glDeleteTextures(1, &it->second.id);
+			textures.erase(it);
+		}
+	}
+
+	size_t Size() const { return textures.size(); }
+};
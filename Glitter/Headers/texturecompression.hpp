@@ -0,0 +1,207 @@
+#pragma once
+#include "glitter.hpp"
+#include "cache.hpp"
+#include <soil/soil.h>
+#include <soil/image_helper.h>
+extern "C" {
+#include <soil/image_DXT.h>
+}
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//set to 0 to always upload uncompressed textures
+#define TEXTURE_COMPRESSION 1
+//bump whenever the cooked file layout or the cooking changes
+#define COMPRESSED_TEXTURE_VERSION 1
+
+//S3TC formats (EXT_texture_compression_s3tc, EXT_texture_sRGB) aren't part of core GL
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+//A DXT1/DXT5 texture with its full mip chain, cooked once from a source image and cached on disk
+class CompressedTexture {
+private:
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levels;
+		//size and modification time of the source image, to detect stale files
+		uint64_t sourceSize;
+		int64_t sourceTime;
+	};
+
+	GLenum format;
+	int width, height;
+	std::vector<std::vector<unsigned char> > levels;
+
+	bool save(const std::string& cachePath, uint64_t sourceSize, int64_t sourceTime) const {
+		Header h;
+		std::memcpy(h.magic, "GDXT", 4);
+		h.version = COMPRESSED_TEXTURE_VERSION;
+		h.format = format;
+		h.width = width;
+		h.height = height;
+		h.levels = (uint32_t)levels.size();
+		h.sourceSize = sourceSize;
+		h.sourceTime = sourceTime;
+
+		//write to a temporary file first so an interrupted write never leaves a truncated file behind
+		std::string tempPath = cachePath + ".tmp";
+		std::ofstream out(tempPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out)
+			return false;
+		out.write((const char*)&h, sizeof(Header));
+		for (size_t i = 0; i < levels.size(); i++) {
+			uint32_t size = (uint32_t)levels[i].size();
+			out.write((const char*)&size, sizeof(size));
+			out.write((const char*)&levels[i][0], size);
+		}
+		out.close();
+		if (!out)
+			return false;
+		std::remove(cachePath.c_str());
+		return std::rename(tempPath.c_str(), cachePath.c_str()) == 0;
+	}
+
+public:
+	CompressedTexture() : format(0), width(0), height(0) {}
+
+	bool IsValid() const { return !levels.empty(); }
+
+	//Path of the cooked file for a source image
+	static std::string CachePath(const std::string& sourcePath) {
+		return Cache::GetPath("textures", Cache::ToHex(Cache::Hash(sourcePath)) + ".dxt");
+	}
+
+	//Reads a cooked texture, fails if it is missing or older than its source
+	bool Load(const std::string& cachePath, const std::string& sourcePath) {
+		levels.clear();
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		if (!Cache::GetFileStamp(sourcePath, sourceSize, sourceTime))
+			return false;
+		std::ifstream in(cachePath.c_str(), std::ios::binary);
+		Header h;
+		if (!in.read((char*)&h, sizeof(Header)))
+			return false;
+		if (std::memcmp(h.magic, "GDXT", 4) != 0 || h.version != COMPRESSED_TEXTURE_VERSION || h.sourceSize != sourceSize || h.sourceTime != sourceTime)
+			return false;
+		if (h.width == 0 || h.height == 0 || h.levels == 0 || h.levels > 32)
+			return false;
+		//only formats Cook writes, anything else is passed straight to glCompressedTexImage2D
+		if (h.format != GL_COMPRESSED_RGB_S3TC_DXT1_EXT && h.format != GL_COMPRESSED_RGBA_S3TC_DXT5_EXT)
+			return false;
+		//a level is never bigger than the top level of an RGBA8 image, in 64 bits so a corrupt header can't overflow it
+		uint64_t maxSize = (uint64_t)h.width * h.height * 4 + 16;
+		format = h.format;
+		width = h.width;
+		height = h.height;
+		levels.resize(h.levels);
+		for (size_t i = 0; i < levels.size(); i++) {
+			uint32_t size = 0;
+			if (!in.read((char*)&size, sizeof(size)) || size == 0 || size > maxSize) {
+				levels.clear();
+				return false;
+			}
+			levels[i].resize(size);
+			if (!in.read((char*)&levels[i][0], size)) {
+				levels.clear();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	//Decodes a source image, builds its mip chain, compresses every level and writes the result to the cache.
+	//Images with alpha become DXT5, everything else DXT1.
+	bool Cook(const std::string& sourcePath, const std::string& cachePath) {
+		levels.clear();
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		if (!Cache::GetFileStamp(sourcePath, sourceSize, sourceTime))
+			return false;
+		int channels;
+		unsigned char* image = SOIL_load_image(sourcePath.c_str(), &width, &height, &channels, SOIL_LOAD_AUTO);
+		if (image == NULL)
+			return false;
+		bool alpha = (channels == 2 || channels == 4);
+		format = alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+
+		//compress each level, then halve it for the next one
+		std::vector<unsigned char> level(image, image + width * height * channels);
+		std::vector<unsigned char> next;
+		int levelWidth = width, levelHeight = height;
+		SOIL_free_image_data(image);
+		while (true) {
+			int size = 0;
+			unsigned char* compressed = alpha ? convert_image_to_DXT5(&level[0], levelWidth, levelHeight, channels, &size)
+				: convert_image_to_DXT1(&level[0], levelWidth, levelHeight, channels, &size);
+			if (compressed == NULL) {
+				levels.clear();
+				return false;
+			}
+			levels.push_back(std::vector<unsigned char>(compressed, compressed + size));
+			free(compressed);
+
+			if (levelWidth == 1 && levelHeight == 1)
+				break;
+			int nextWidth = levelWidth > 1 ? levelWidth / 2 : 1;
+			int nextHeight = levelHeight > 1 ? levelHeight / 2 : 1;
+			next.resize(nextWidth * nextHeight * channels);
+			mipmap_image(&level[0], levelWidth, levelHeight, channels, &next[0], levelWidth > 1 ? 2 : 1, levelHeight > 1 ? 2 : 1);
+			level.swap(next);
+			levelWidth = nextWidth;
+			levelHeight = nextHeight;
+		}
+		save(cachePath, sourceSize, sourceTime);
+		return true;
+	}
+
+	//Uploads the precomputed mip chain with glCompressedTexImage2D
+	void Upload(GLuint textureID, bool gamma) const {
+		GLenum internalFormat = format;
+		if (gamma)
+			internalFormat = (format == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT) ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		for (size_t i = 0; i < levels.size(); i++) {
+			int levelWidth = width >> i, levelHeight = height >> i;
+			glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)i, internalFormat, levelWidth > 0 ? levelWidth : 1, levelHeight > 0 ? levelHeight : 1, 0, (GLsizei)levels[i].size(), &levels[i][0]);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+
+		// Parameters
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	//S3TC is an extension, check for it before cooking (must be called on the GL thread)
+	static bool Supported() {
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++) {
+			const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (name != NULL && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+				return true;
+		}
+		return false;
+	}
+};
@@ -0,0 +1,145 @@
+#pragma once
+#include "glitter.hpp"
+#include "texturecompression.hpp"
+#include <soil/soil.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//Decodes textures on a pool of worker threads.
+//When S3TC is available the workers load (or cook on first use) block-compressed textures with a precomputed mip chain instead.
+//Texture names are generated immediately on the GL thread so meshes can reference them right away,
+//the decoded images are handed back and uploaded on the GL thread in completion order by Finish().
+class TextureLoader {
+private:
+	struct Job {
+		GLuint id;
+		std::string filename;
+		bool gamma;
+		unsigned char* image;
+		int width, height;
+		CompressedTexture compressed;
+	};
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	//signalled when a job is queued or the pool shuts down
+	std::condition_variable jobQueued;
+	//signalled when a job has been decoded
+	std::condition_variable jobDecoded;
+	std::deque<Job> queue;
+	std::deque<Job> decoded;
+	//jobs queued or decoding, but not yet uploaded
+	size_t outstanding;
+	bool stopping;
+	//upload block-compressed textures from the texture cache
+	bool compress;
+
+	TextureLoader(const TextureLoader&);
+	TextureLoader& operator=(const TextureLoader&);
+
+	void work() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			jobQueued.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (queue.empty())
+				return;
+			Job job = std::move(queue.front());
+			queue.pop_front();
+
+			//decode without holding the lock
+			lock.unlock();
+			if (compress) {
+				std::string cachePath = CompressedTexture::CachePath(job.filename);
+				if (!job.compressed.Load(cachePath, job.filename))
+					job.compressed.Cook(job.filename, cachePath);
+			}
+			if (!job.compressed.IsValid())
+				job.image = SOIL_load_image(job.filename.c_str(), &job.width, &job.height, 0, SOIL_LOAD_RGB);
+			lock.lock();
+
+			decoded.push_back(std::move(job));
+			jobDecoded.notify_one();
+		}
+	}
+
+public:
+	TextureLoader(unsigned int numThreads = std::thread::hardware_concurrency()) : outstanding(0), stopping(false) {
+		compress = TEXTURE_COMPRESSION && CompressedTexture::Supported();
+		if (numThreads == 0)
+			numThreads = 1;
+		for (unsigned int i = 0; i < numThreads; i++)
+			workers.push_back(std::thread(&TextureLoader::work, this));
+	}
+
+	~TextureLoader() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			queue.clear();
+		}
+		jobQueued.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+		for (size_t i = 0; i < decoded.size(); i++)
+			SOIL_free_image_data(decoded[i].image);
+	}
+
+	//Queues a texture for decoding and returns its (not yet populated) texture name
+	GLuint Load(const std::string& filename, bool gamma = false) {
+		Job job;
+		glGenTextures(1, &job.id);
+		job.filename = filename;
+		job.gamma = gamma;
+		job.image = NULL;
+		job.width = job.height = 0;
+		GLuint textureID = job.id;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(std::move(job));
+			outstanding++;
+		}
+		jobQueued.notify_one();
+		return textureID;
+	}
+
+	//Uploads every queued texture as soon as its decode finishes, returns once all are uploaded
+	void Finish() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (outstanding > 0) {
+			jobDecoded.wait(lock, [this] { return !decoded.empty(); });
+			Job job = std::move(decoded.front());
+			decoded.pop_front();
+			outstanding--;
+
+			//upload without blocking the workers
+			lock.unlock();
+			if (job.compressed.IsValid())
+				job.compressed.Upload(job.id, job.gamma);
+			else if (job.image == NULL)
+				std::cout << "Texture failed to load at path: " << job.filename << std::endl;
+			else
+				Upload(job.id, job.image, job.width, job.height, job.gamma);
+			SOIL_free_image_data(job.image);
+			lock.lock();
+		}
+	}
+
+	//Uploads a decoded RGB image to the given texture name and builds its mipmaps
+	static void Upload(GLuint textureID, const unsigned char* image, int width, int height, bool gamma) {
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, gamma ? GL_SRGB : GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+		// Parameters
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+};
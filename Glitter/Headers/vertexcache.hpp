@@ -0,0 +1,198 @@
+#pragma once
+#include "mesh.hpp"
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <cmath>
+
+//FIFO size used to report the average cache miss ratio (ACMR)
+#define VERTEX_CACHE_REPORT_SIZE 16
+//LRU size modelled by the triangle reordering
+#define VERTEX_CACHE_OPTIMIZE_SIZE 32
+
+//Import-time mesh optimizations: vertex welding, triangle reordering for the post-transform
+//vertex cache (Forsyth's linear-speed algorithm) and vertex reordering for fetch locality
+class VertexCacheOptimizer {
+private:
+	struct VertexHash {
+		size_t operator()(const Vertex& v) const {
+			const unsigned char* bytes = (const unsigned char*)&v;
+			size_t hash = 2166136261u;
+			for (size_t i = 0; i < sizeof(Vertex); i++) {
+				hash ^= bytes[i];
+				hash *= 16777619u;
+			}
+			return hash;
+		}
+	};
+
+	struct VertexEqual {
+		bool operator()(const Vertex& a, const Vertex& b) const {
+			return memcmp(&a, &b, sizeof(Vertex)) == 0;
+		}
+	};
+
+	//Forsyth's vertex score: favours vertices recently used and vertices with few remaining triangles
+	static float vertexScore(int cachePosition, GLuint remainingTriangles) {
+		if (remainingTriangles == 0)
+			return -1.0f;
+		float score = 0.0f;
+		if (cachePosition >= 0) {
+			//the triangle just added gets a fixed score so the next one isn't forced to reuse all of it
+			if (cachePosition < 3)
+				score = 0.75f;
+			else
+				score = powf(1.0f - (cachePosition - 3) / (float)(VERTEX_CACHE_OPTIMIZE_SIZE - 3), 1.5f);
+		}
+		//boost vertices with few triangles left so they get finished off
+		return score + 2.0f * powf((float)remainingTriangles, -0.5f);
+	}
+
+public:
+	//Merges bit-identical vertices and remaps the indices
+	static void Weld(vector<Vertex>& vertices, vector<GLuint>& indices) {
+		std::unordered_map<Vertex, GLuint, VertexHash, VertexEqual> unique;
+		unique.reserve(vertices.size());
+		vector<GLuint> remap(vertices.size());
+		vector<Vertex> welded;
+		welded.reserve(vertices.size());
+		for (GLuint i = 0; i < vertices.size(); i++) {
+			std::pair<std::unordered_map<Vertex, GLuint, VertexHash, VertexEqual>::iterator, bool> result = unique.insert(std::make_pair(vertices[i], (GLuint)welded.size()));
+			if (result.second)
+				welded.push_back(vertices[i]);
+			remap[i] = result.first->second;
+		}
+		for (GLuint i = 0; i < indices.size(); i++)
+			indices[i] = remap[indices[i]];
+		vertices.swap(welded);
+	}
+
+	//Reorders triangles to maximize post-transform vertex cache hits
+	static void OptimizeTriangleOrder(vector<GLuint>& indices, GLuint numVertices) {
+		GLuint numTriangles = indices.size() / 3;
+		if (numTriangles == 0)
+			return;
+
+		//vertex -> triangles adjacency
+		vector<GLuint> remaining(numVertices, 0);
+		for (GLuint i = 0; i < numTriangles * 3; i++)
+			remaining[indices[i]]++;
+		vector<GLuint> adjacencyOffset(numVertices + 1, 0);
+		for (GLuint v = 0; v < numVertices; v++)
+			adjacencyOffset[v + 1] = adjacencyOffset[v] + remaining[v];
+		vector<GLuint> adjacency(numTriangles * 3);
+		vector<GLuint> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+		for (GLuint t = 0; t < numTriangles; t++)
+			for (GLuint k = 0; k < 3; k++)
+				adjacency[fill[indices[t * 3 + k]]++] = t;
+
+		vector<int> cachePosition(numVertices, -1);
+		vector<float> score(numVertices);
+		for (GLuint v = 0; v < numVertices; v++)
+			score[v] = vertexScore(-1, remaining[v]);
+		vector<float> triangleScore(numTriangles);
+		vector<bool> added(numTriangles, false);
+		for (GLuint t = 0; t < numTriangles; t++)
+			triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+		vector<GLuint> cache, newCache;
+		vector<GLuint> output;
+		output.reserve(indices.size());
+		GLuint scanPosition = 0;
+		int best = -1;
+		for (GLuint emitted = 0; emitted < numTriangles; emitted++) {
+			//nothing adjacent to the cache is left, fall back to the best remaining triangle
+			if (best < 0) {
+				float bestScore = -1.0f;
+				while (scanPosition < numTriangles && added[scanPosition])
+					scanPosition++;
+				for (GLuint t = scanPosition; t < numTriangles; t++) {
+					if (!added[t] && triangleScore[t] > bestScore) {
+						bestScore = triangleScore[t];
+						best = t;
+					}
+				}
+			}
+
+			//emit the triangle and detach it from its vertices
+			added[best] = true;
+			newCache.clear();
+			for (GLuint k = 0; k < 3; k++) {
+				GLuint v = indices[best * 3 + k];
+				output.push_back(v);
+				newCache.push_back(v);
+				GLuint* begin = &adjacency[adjacencyOffset[v]];
+				GLuint* end = begin + remaining[v];
+				for (GLuint* it = begin; it != end; it++) {
+					if (*it == (GLuint)best) {
+						*it = *(end - 1);
+						break;
+					}
+				}
+				remaining[v]--;
+			}
+			//move the triangle's vertices to the front of the LRU cache
+			for (GLuint i = 0; i < cache.size(); i++) {
+				GLuint v = cache[i];
+				if (v != newCache[0] && v != newCache[1] && v != newCache[2])
+					newCache.push_back(v);
+			}
+			for (GLuint i = 0; i < newCache.size(); i++)
+				cachePosition[newCache[i]] = i < VERTEX_CACHE_OPTIMIZE_SIZE ? (int)i : -1;
+
+			//rescore the vertices in the cache and their triangles, remembering the best one
+			best = -1;
+			float bestScore = -1.0f;
+			for (GLuint i = 0; i < newCache.size(); i++) {
+				GLuint v = newCache[i];
+				float newScore = vertexScore(cachePosition[v], remaining[v]);
+				float delta = newScore - score[v];
+				score[v] = newScore;
+				for (GLuint j = 0; j < remaining[v]; j++) {
+					GLuint t = adjacency[adjacencyOffset[v] + j];
+					triangleScore[t] += delta;
+					if (triangleScore[t] > bestScore) {
+						bestScore = triangleScore[t];
+						best = t;
+					}
+				}
+			}
+			if (newCache.size() > VERTEX_CACHE_OPTIMIZE_SIZE)
+				newCache.resize(VERTEX_CACHE_OPTIMIZE_SIZE);
+			cache.swap(newCache);
+		}
+		indices.swap(output);
+	}
+
+	//Renumbers vertices in order of first use so vertex fetches walk the buffer linearly, unused vertices are dropped
+	static void OptimizeVertexOrder(vector<Vertex>& vertices, vector<GLuint>& indices) {
+		const GLuint unused = 0xFFFFFFFF;
+		vector<GLuint> remap(vertices.size(), unused);
+		vector<Vertex> ordered;
+		ordered.reserve(vertices.size());
+		for (GLuint i = 0; i < indices.size(); i++) {
+			GLuint& v = remap[indices[i]];
+			if (v == unused) {
+				v = ordered.size();
+				ordered.push_back(vertices[indices[i]]);
+			}
+			indices[i] = v;
+		}
+		vertices.swap(ordered);
+	}
+
+	//Number of vertex shader invocations for the index stream with a FIFO post-transform cache
+	static GLuint CacheMisses(const vector<GLuint>& indices, GLuint numVertices, GLuint cacheSize = VERTEX_CACHE_REPORT_SIZE) {
+		//a vertex is cached if it missed less than cacheSize misses ago
+		vector<GLuint> missTime(numVertices, 0);
+		GLuint misses = 0;
+		for (GLuint i = 0; i < indices.size(); i++) {
+			GLuint v = indices[i];
+			if (missTime[v] == 0 || misses - missTime[v] >= cacheSize) {
+				misses++;
+				missTime[v] = misses;
+			}
+		}
+		return misses;
+	}
+};
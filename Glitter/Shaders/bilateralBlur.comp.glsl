@@ -0,0 +1,80 @@
+#version 430 core
+//taps on each side of the pixel
+#ifndef BLUR_RADIUS
+#define BLUR_RADIUS 3
+#endif
+//image format of the output, r16f for occlusion and rgba16f for radiosity
+#ifndef BLUR_FORMAT
+#define BLUR_FORMAT rgba16f
+#endif
+//the input is at 1/INDIRECT_DOWNSAMPLE of the G-buffer's resolution
+#ifndef INDIRECT_DOWNSAMPLE
+#define INDIRECT_DOWNSAMPLE 1
+#endif
+//pixels of a line blurred by one work group
+#ifndef BLUR_GROUP
+#define BLUR_GROUP 128
+#endif
+layout (local_size_x = BLUR_GROUP) in;
+
+uniform sampler2D bufferInput;
+//first layer of the G-buffer guides the weights
+uniform sampler2DArray bufferPosition;
+uniform sampler2DArray bufferNormal;
+//blur along x, or along y
+uniform int horizontal;
+layout (BLUR_FORMAT) writeonly uniform image2D bufferOutput;
+
+//gaussian falloff along the line
+const float sigma = BLUR_RADIUS * 0.5 + 0.5;
+//relative depth difference at which a tap is ignored
+const float depthTolerance = 0.1;
+//how quickly taps lose weight as normals diverge
+const float normalPower = 8.0;
+
+//the group's part of the line plus BLUR_RADIUS pixels on either side
+shared vec4 values[BLUR_GROUP + 2 * BLUR_RADIUS];
+shared float depths[BLUR_GROUP + 2 * BLUR_RADIUS];
+shared vec3 normals[BLUR_GROUP + 2 * BLUR_RADIUS];
+
+ivec2 linePixel(int i)
+{
+	return horizontal != 0 ? ivec2(i, gl_WorkGroupID.y) : ivec2(gl_WorkGroupID.y, i);
+}
+
+void main()
+{
+	ivec2 size = textureSize(bufferInput, 0);
+	int start = int(gl_WorkGroupID.x) * BLUR_GROUP - BLUR_RADIUS;
+
+	//fetch every texel of the line once, clamped at the edges
+	for (int slot = int(gl_LocalInvocationID.x); slot < BLUR_GROUP + 2 * BLUR_RADIUS; slot += BLUR_GROUP) {
+		ivec2 pixel = clamp(linePixel(start + slot), ivec2(0), size - 1);
+		values[slot] = texelFetch(bufferInput, pixel, 0);
+		//the G-buffer texel the input pixel was computed at
+		ivec3 guide = ivec3(pixel * INDIRECT_DOWNSAMPLE, 0);
+		depths[slot] = -texelFetch(bufferPosition, guide, 0).z;
+		normals[slot] = texelFetch(bufferNormal, guide, 0).xyz;
+	}
+	barrier();
+
+	int center = int(gl_LocalInvocationID.x) + BLUR_RADIUS;
+	ivec2 pixel = linePixel(start + center);
+	if (pixel.x >= size.x || pixel.y >= size.y)
+		return;
+
+	vec4 result = values[center];
+	float total = 1.0;
+	for (int x = -BLUR_RADIUS; x <= BLUR_RADIUS; x++) {
+		if (x == 0)
+			continue;
+		int slot = center + x;
+		float weight = exp(-float(x * x) / (2.0 * sigma * sigma));
+		//don't blur across depth discontinuities or creases
+		weight *= max(0.0, 1.0 - abs(depths[slot] - depths[center]) / (depthTolerance * max(depths[center], 0.001)));
+		weight *= pow(max(dot(normals[slot], normals[center]), 0.0), normalPower);
+		result += values[slot] * weight;
+		total += weight;
+	}
+	imageStore(bufferOutput, pixel, result / total);
+}
@@ -0,0 +1,71 @@
+#version 430 core
+//the input is at 1/INDIRECT_DOWNSAMPLE of the G-buffer's resolution
+#ifndef INDIRECT_DOWNSAMPLE
+#define INDIRECT_DOWNSAMPLE 2
+#endif
+//image format of the output, r16f for occlusion and rgba16f for radiosity
+#ifndef BLUR_FORMAT
+#define BLUR_FORMAT rgba16f
+#endif
+//work group size in each dimension
+#ifndef UPSAMPLE_GROUP
+#define UPSAMPLE_GROUP 8
+#endif
+layout (local_size_x = UPSAMPLE_GROUP, local_size_y = UPSAMPLE_GROUP) in;
+
+uniform sampler2D bufferInput;
+//first layer of the G-buffer guides the weights
+uniform sampler2DArray bufferPosition;
+uniform sampler2DArray bufferNormal;
+layout (BLUR_FORMAT) writeonly uniform image2D bufferOutput;
+
+//relative depth difference at which a tap is ignored
+const float depthTolerance = 0.1;
+//how quickly taps lose weight as normals diverge
+const float normalPower = 8.0;
+const float epsilon = 0.0001;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = textureSize(bufferPosition, 0).xy;
+	if (pixel.x >= size.x || pixel.y >= size.y)
+		return;
+	ivec2 inputSize = textureSize(bufferInput, 0);
+
+	float depth = -texelFetch(bufferPosition, ivec3(pixel, 0), 0).z;
+	vec3 normal = texelFetch(bufferNormal, ivec3(pixel, 0), 0).xyz;
+
+	//the four input pixels around this one, weighted bilinearly
+	//input pixel q was computed at G-buffer texel q * INDIRECT_DOWNSAMPLE, not at its block's centre
+	vec2 coords = vec2(pixel) / INDIRECT_DOWNSAMPLE;
+	ivec2 base = ivec2(floor(coords));
+	vec2 f = coords - vec2(base);
+
+	vec4 result = vec4(0.0);
+	float total = 0.0;
+	vec4 nearest = vec4(0.0);
+	float nearestWeight = -1.0;
+	for (int i = 0; i < 4; i++) {
+		ivec2 offset = ivec2(i & 1, i >> 1);
+		ivec2 tap = clamp(base + offset, ivec2(0), inputSize - 1);
+		vec4 value = texelFetch(bufferInput, tap, 0);
+		//the G-buffer texel the input pixel was computed at
+		ivec3 guide = ivec3(min(tap * INDIRECT_DOWNSAMPLE, size - 1), 0);
+		float tapDepth = -texelFetch(bufferPosition, guide, 0).z;
+		vec3 tapNormal = texelFetch(bufferNormal, guide, 0).xyz;
+
+		float bilinear = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+		//don't smear across depth discontinuities or creases
+		float weight = max(0.0, 1.0 - abs(tapDepth - depth) / (depthTolerance * max(depth, 0.001)));
+		weight *= pow(max(dot(tapNormal, normal), 0.0), normalPower);
+		result += value * weight * bilinear;
+		total += weight * bilinear;
+		//fall back to the most similar tap if none are close
+		if (weight > nearestWeight) {
+			nearest = value;
+			nearestWeight = weight;
+		}
+	}
+	imageStore(bufferOutput, pixel, total > epsilon ? result / total : nearest);
+}
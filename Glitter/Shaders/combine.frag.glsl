@@ -2,25 +2,11 @@
 in vec2 TexCoords;
 out vec4 color;
 
+//radiosity, already blurred by bilateralBlur.comp.glsl
 uniform sampler2D bufferRadiosity;
 uniform sampler2DArray bufferColor;
 
-const int blurKernelSize = 4;
-
-
 void main()
 {
-    vec2 texelSize = 1.0 / vec2(textureSize(bufferRadiosity, 0));
-    vec3 result = vec3(0,0,0);
-
-	int blurOffset = blurKernelSize/2;
-
-	//apply box blur (average)
-    for (int x = -blurOffset; x < blurOffset; x++) {
-        for (int y = -blurOffset; y < blurOffset; y++) {
-            vec2 offset = vec2(float(x), float(y)) * texelSize;
-            result += texture(bufferRadiosity, TexCoords + offset).rgb;
-        }
-    }
-    color = vec4(result / (blurKernelSize * blurKernelSize) + texture(bufferColor, vec3(TexCoords, 0)).rgb, 1);
-}  
\ No newline at end of file
+    color = vec4(texture(bufferRadiosity, TexCoords).rgb + texture(bufferColor, vec3(TexCoords, 0)).rgb, 1);
+}  
@@ -1,13 +1,13 @@
-#version 330 core
+#version 430 core
 in vec4 FragPos;
+flat in vec3 LightPos;
 
-uniform vec3 lightPos;
 uniform float farPlane;
 
 void main()
 {
     // get distance between fragment and light source
-    float lightDistance = length(FragPos.xyz - lightPos);
+    float lightDistance = length(FragPos.xyz - LightPos);
     
     // map to [0;1] range by dividing by far_plane
     lightDistance = lightDistance / farPlane;
@@ -1,24 +1,57 @@
-#version 330 core
+#version 430 core
 layout (triangles) in;
 layout (triangle_strip, max_vertices=18) out;
 
-uniform mat4 shadowMatrices[6];
+//only emit triangles to the faces whose frustum they overlap
+#ifndef CULL_FACES
+#define CULL_FACES 1
+#endif
+
+//std430 layout, matches ShadowData
+struct ShadowData {
+	mat4 faces[6];
+	vec3 lightPos;
+	int layer;
+};
+layout (std430) readonly buffer ShadowBlock {
+	ShadowData shadows[];
+};
+
+flat in int Shadow[];
 
 out vec4 FragPos;
+flat out vec3 LightPos;
+
+//true if all three vertices are beyond the same clip plane
+bool outsideFace(vec4 a, vec4 b, vec4 c)
+{
+	return (a.x < -a.w && b.x < -b.w && c.x < -c.w) || (a.x > a.w && b.x > b.w && c.x > c.w)
+		|| (a.y < -a.w && b.y < -b.w && c.y < -c.w) || (a.y > a.w && b.y > b.w && c.y > c.w)
+		|| (a.z < -a.w && b.z < -b.w && c.z < -c.w) || (a.z > a.w && b.z > b.w && c.z > c.w);
+}
 
 void main()
 {
+	int shadow = Shadow[0];
     for(int face = 0; face < 6; face++)
     {
-		//which face of cubemap we are rendering to
-        gl_Layer = face;
+		vec4 clip[3];
+		for(int i = 0; i < 3; i++)
+			clip[i] = shadows[shadow].faces[face] * gl_in[i].gl_Position;
+#if CULL_FACES
+		if (outsideFace(clip[0], clip[1], clip[2]))
+			continue;
+#endif
+		//which layer-face of the cubemap array we are rendering to
+        gl_Layer = shadows[shadow].layer + face;
 		//create a triangle
         for(int i = 0; i < 3; i++)
         {
             FragPos = gl_in[i].gl_Position;
-            gl_Position = shadowMatrices[face] * FragPos;
+            LightPos = shadows[shadow].lightPos;
+            gl_Position = clip[i];
             EmitVertex();
         }    
         EndPrimitive();
     }
-}  
\ No newline at end of file
+}  
@@ -1,10 +1,14 @@
-#version 330 core
+#version 430 core
 layout (location = 0) in vec3 position;
 
 uniform mat4 model;
-uniform mat4 view;
+
+//which of the shadows being drawn this instance renders
+flat out int Shadow;
 
 void main()
 {
-    gl_Position = view * model * vec4(position, 1.0);
-}  
\ No newline at end of file
+    //shadow cubemaps are rendered in world space
+    gl_Position = model * vec4(position, 1.0);
+    Shadow = gl_InstanceID;
+}  
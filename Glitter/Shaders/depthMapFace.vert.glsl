@@ -0,0 +1,18 @@
+#version 430 core
+layout (location = 0) in vec3 position;
+
+uniform mat4 model;
+//light-space transformation of the cube face being rendered
+uniform mat4 shadowMatrix;
+uniform vec3 lightPos;
+
+out vec4 FragPos;
+flat out vec3 LightPos;
+
+void main()
+{
+    //shadow cubemaps are rendered in world space
+    FragPos = model * vec4(position, 1.0);
+    LightPos = lightPos;
+    gl_Position = shadowMatrix * FragPos;
+}  
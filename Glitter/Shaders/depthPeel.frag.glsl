@@ -0,0 +1,23 @@
+#version 430 core
+in vec3 ViewPos;
+
+//first layer depth of this frame, from the pass before
+uniform sampler2D firstLayer;
+
+//minimum separation between layers (in world space units)
+#ifndef MINIMUM_SEPARATION
+#define MINIMUM_SEPARATION 1
+#endif
+
+//for linearizing depth to apply minimum separation
+uniform float nearPlane = 0.1;
+uniform float farPlane = 1000;
+
+//Keeps the closest fragments at least the minimum separation behind the first layer (depth peeling)
+void main()
+{
+	float firstZ = 2.0 * texelFetch(firstLayer, ivec2(gl_FragCoord.xy), 0).r - 1.0;
+	float firstZLinear = 2.0 * nearPlane * farPlane / (farPlane + nearPlane - firstZ * (farPlane - nearPlane));
+	if(-ViewPos.z <= firstZLinear + MINIMUM_SEPARATION)
+		discard;
+}
@@ -0,0 +1,15 @@
+#version 430 core
+layout (location = 0) in vec3 position;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+
+out vec3 ViewPos;
+
+void main()
+{
+	vec4 viewPos = view * model * vec4(position, 1.0);
+	ViewPos = viewPos.xyz;
+	gl_Position = projection * viewPos;
+}
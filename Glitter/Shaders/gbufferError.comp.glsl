@@ -0,0 +1,68 @@
+#version 430 core
+//work group size in each dimension
+#ifndef GBUFFER_ERROR_GROUP
+#define GBUFFER_ERROR_GROUP 8
+#endif
+layout (local_size_x = GBUFFER_ERROR_GROUP, local_size_y = GBUFFER_ERROR_GROUP) in;
+
+//positions of the G-buffer, the second layer is measured
+uniform sampler2DArray bufferPosition;
+//exact second layer depth from depth peeling
+uniform sampler2D referenceDepth;
+
+//for linearizing the reference depth
+uniform float nearPlane = 0.1;
+uniform float farPlane = 1000;
+
+#ifndef GBUFFER_ERROR_BINDING
+#define GBUFFER_ERROR_BINDING 5
+#endif
+layout (std430, binding = GBUFFER_ERROR_BINDING) buffer ErrorBlock {
+	uint wrongPixels;
+	//relative depth errors in 1/1000ths
+	uint errorSum;
+};
+
+//relative depth difference above which a pixel counts as wrong
+const float tolerance = 0.01;
+
+shared uint groupWrong;
+shared uint groupError;
+
+void main()
+{
+	if (gl_LocalInvocationIndex == 0) {
+		groupWrong = 0;
+		groupError = 0;
+	}
+	barrier();
+
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = textureSize(referenceDepth, 0);
+	if (pixel.x < size.x && pixel.y < size.y) {
+		float reference = texelFetch(referenceDepth, pixel, 0).r;
+		//discarded second layer fragments leave the cleared position
+		float depth = -texelFetch(bufferPosition, ivec3(pixel, 1), 0).z;
+		bool referenceEmpty = reference >= 1.0;
+		bool empty = depth <= 0.0;
+
+		float error = 0.0;
+		if (referenceEmpty != empty)
+			error = 1.0;
+		else if (!empty) {
+			float z = 2.0 * reference - 1.0;
+			float referenceLinear = 2.0 * nearPlane * farPlane / (farPlane + nearPlane - z * (farPlane - nearPlane));
+			error = min(abs(depth - referenceLinear) / referenceLinear, 1.0);
+		}
+		if (error > tolerance)
+			atomicAdd(groupWrong, 1);
+		atomicAdd(groupError, uint(error * 1000.0));
+	}
+
+	//one global atomic per group
+	barrier();
+	if (gl_LocalInvocationIndex == 0) {
+		atomicAdd(wrongPixels, groupWrong);
+		atomicAdd(errorSum, groupError);
+	}
+}
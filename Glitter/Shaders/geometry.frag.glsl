@@ -1,4 +1,11 @@
 #version 430 core
+//only the first layer and the one separated behind it are written, further layers would be left undefined
+#ifndef GBUFFER_LAYERS
+#define GBUFFER_LAYERS 2
+#endif
+#if GBUFFER_LAYERS != 2
+#error geometry.frag.glsl only generates two G-buffer layers
+#endif
 layout (location = 0) out vec3 positionBuffer;
 layout (location = 1) out vec3 normalBuffer;
 layout (location = 2) out vec4 colorBuffer;
@@ -12,10 +19,16 @@ uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_specular1;
 uniform sampler2D texture_normal1;
 
+//the first layer depth the second layer is compared against, usually last frame's
 uniform sampler2DArray bufferDepthCompare;
+//from this frame's camera space to that depth buffer's, and its projection
+uniform mat4 reprojection;
+uniform mat4 prevProjection;
 
 //minimum separation between layers (in world space units)
+#ifndef MINIMUM_SEPARATION
 #define MINIMUM_SEPARATION 1
+#endif
 
 //for linearizing/delinearizing depth to apply minimum separation
 uniform float nearPlane = 0.1;
@@ -30,19 +43,18 @@ void main()
 		colorBuffer.a = texture(texture_specular1, TexCoords).r;
 	}
 	else if(gl_Layer == 1) {
-		vec2 ndc = (ClipSpaceCoords.xy/ClipSpaceCoords.w)/2.0 + 0.5;
+		//where this fragment is in the compared depth buffer, and how far from its camera
+		vec4 prevPos = reprojection * vec4(FragPos, 1.0);
+		vec4 prevClip = prevProjection * prevPos;
+		vec2 ndc = (prevClip.xy/prevClip.w)/2.0 + 0.5;
 		//minimum separation is in linear world space
 		//first linearize z from prev layer depth buffer
 		float prevLayerZ = texture(bufferDepthCompare, vec3(ndc, 0)).r;
 		float prevLayerZLinear = 2.0 * prevLayerZ - 1.0;
 		prevLayerZLinear = 2.0 * nearPlane * farPlane / (farPlane + nearPlane - prevLayerZLinear * (farPlane - nearPlane));
-		//add minimum separation
-		prevLayerZLinear += MINIMUM_SEPARATION;
-		//convert back to nonlinear depth space
-		float compareDepth = (farPlane + nearPlane - 2.0 * nearPlane * farPlane / prevLayerZLinear) / (farPlane - nearPlane);
-		compareDepth = (compareDepth + 1.0) / 2.0;
 
-		if(gl_FragCoord.z > compareDepth) {
+		//keep fragments at least the minimum separation behind the compared first layer, along its view ray
+		if(prevClip.w > 0 && -prevPos.z > prevLayerZLinear + MINIMUM_SEPARATION) {
 			positionBuffer = FragPos;
 			normalBuffer = normalize(Normal);
 			colorBuffer.rgb = texture(texture_diffuse1, TexCoords).rgb;
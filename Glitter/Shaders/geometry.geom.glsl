@@ -1,6 +1,13 @@
 #version 430 core
+#ifndef GBUFFER_LAYERS
+#define GBUFFER_LAYERS 2
+#endif
+//one triangle per layer, layout qualifiers can't hold expressions before GLSL 4.40
+#ifndef GBUFFER_MAX_VERTICES
+#define GBUFFER_MAX_VERTICES 6
+#endif
 layout (triangles) in;
-layout (triangle_strip, max_vertices=6) out;
+layout (triangle_strip, max_vertices=GBUFFER_MAX_VERTICES) out;
 
 in vec3 fragPos[];
 in vec2 texCoords[];
@@ -12,12 +19,14 @@ out vec2 TexCoords;
 out vec3 Normal;
 out vec4 ClipSpaceCoords;
 
-#define GBUFFER_LAYERS 2
+//range of layers drawn, all of them unless the layers are drawn in separate passes
+uniform int firstLayer = 0;
+uniform int endLayer = GBUFFER_LAYERS;
 
 void main()
 {
-	//send triangle to all layers
-	for(int layer = 0; layer < GBUFFER_LAYERS; layer++) {
+	//send triangle to all layers in the range
+	for(int layer = firstLayer; layer < endLayer; layer++) {
 		gl_Layer = layer;
 		for(int i = 0; i < 3; i++)
 		{
@@ -12,6 +12,18 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+//set when the mesh stores its normals octahedral-encoded in .xy (packed vertex layout)
+uniform bool octahedralNormals = false;
+
+vec3 octahedralDecode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	//fold the lower hemisphere back
+	if(n.z < 0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0 ? 1.0 : -1.0, n.y >= 0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
 void main()
 {
     vec4 viewPos = view * model * vec4(Position, 1.0f);
@@ -20,5 +32,5 @@ void main()
 	gl_Position = clipSpaceCoords;
     texCoords = TexCoords;
     mat3 normalMatrix = transpose(inverse(mat3(view * model)));
-    normal = normalMatrix * Normal;
+    normal = normalMatrix * (octahedralNormals ? octahedralDecode(Normal.xy) : Normal);
 }
\ No newline at end of file
@@ -0,0 +1,156 @@
+#version 430 core
+#ifndef LIGHT_TILE_SIZE
+#define LIGHT_TILE_SIZE 16
+#endif
+#ifndef MAX_LIGHTS_PER_TILE
+#define MAX_LIGHTS_PER_TILE 63
+#endif
+#ifndef GBUFFER_LAYERS
+#define GBUFFER_LAYERS 2
+#endif
+#define TILE_THREADS (LIGHT_TILE_SIZE * LIGHT_TILE_SIZE)
+//candidates sorted when a tile overflows: the kept lights plus one per thread, a power of two
+#ifndef TILE_SORT_SIZE
+#define TILE_SORT_SIZE 512
+#endif
+#if MAX_LIGHTS_PER_TILE + TILE_THREADS > TILE_SORT_SIZE
+#error TILE_SORT_SIZE must hold MAX_LIGHTS_PER_TILE plus a light per thread
+#endif
+layout (local_size_x = LIGHT_TILE_SIZE, local_size_y = LIGHT_TILE_SIZE) in;
+
+//std430 layout, matches LightData, positions are in world space
+struct PointLight {
+	vec3 pos;
+	float a;
+	vec3 ambient;
+	float b;
+	vec3 diffuse;
+	float c;
+	vec3 specular;
+	int shadowIndex;
+	float radius;
+};
+layout (std430) readonly buffer LightBlock {
+	int lightCount;
+	PointLight lights[];
+};
+//per tile: the number of lights followed by MAX_LIGHTS_PER_TILE light indices
+layout (std430) writeonly buffer TileBlock {
+	uint tileLights[];
+};
+
+//view space positions
+uniform sampler2DArray bufferPosition;
+uniform mat4 view;
+uniform mat4 invProjection;
+
+//depth bounds of the tile, positive floats compare like their bit patterns
+shared uint minDepth;
+shared uint maxDepth;
+shared uint tileCount;
+//quantized distance to the tile in the upper 16 bits, light index in the lower 16
+shared uint tileList[TILE_SORT_SIZE];
+
+//view space point on the far plane
+vec3 viewCorner(vec2 ndc)
+{
+	vec4 corner = invProjection * vec4(ndc, 1.0, 1.0);
+	return corner.xyz / corner.w;
+}
+
+//Bitonic sort of the first count entries of the tile list, ascending, the rest is padded to sort last
+void sortTileList(uint count)
+{
+	for (uint i = count + gl_LocalInvocationIndex; i < TILE_SORT_SIZE; i += TILE_THREADS)
+		tileList[i] = 0xFFFFFFFFu;
+	barrier();
+	for (uint k = 2; k <= TILE_SORT_SIZE; k <<= 1) {
+		for (uint j = k >> 1; j > 0; j >>= 1) {
+			for (uint i = gl_LocalInvocationIndex; i < TILE_SORT_SIZE; i += TILE_THREADS) {
+				uint partner = i ^ j;
+				uint a = tileList[i];
+				uint b = tileList[partner];
+				if (partner > i && (a > b) == ((i & k) == 0)) {
+					tileList[i] = b;
+					tileList[partner] = a;
+				}
+			}
+			barrier();
+		}
+	}
+}
+
+void main()
+{
+	if (gl_LocalInvocationIndex == 0) {
+		minDepth = floatBitsToUint(3.402823e38);
+		maxDepth = 0;
+		tileCount = 0;
+	}
+	barrier();
+
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = textureSize(bufferPosition, 0).xy;
+	if (pixel.x < size.x && pixel.y < size.y) {
+		for (int layer = 0; layer < GBUFFER_LAYERS; layer++) {
+			float z = texelFetch(bufferPosition, ivec3(pixel, layer), 0).z;
+			//nothing was drawn where the position is still cleared to zero
+			if (z < 0.0) {
+				atomicMin(minDepth, floatBitsToUint(-z));
+				atomicMax(maxDepth, floatBitsToUint(-z));
+			}
+		}
+	}
+	barrier();
+
+	//side planes of the tile frustum, through the eye with outward normals
+	vec2 tileMin = vec2(gl_WorkGroupID.xy * LIGHT_TILE_SIZE) / vec2(size) * 2.0 - 1.0;
+	vec2 tileMax = vec2((gl_WorkGroupID.xy + 1) * LIGHT_TILE_SIZE) / vec2(size) * 2.0 - 1.0;
+	vec3 corners[4];
+	corners[0] = viewCorner(tileMin);
+	corners[1] = viewCorner(vec2(tileMax.x, tileMin.y));
+	corners[2] = viewCorner(tileMax);
+	corners[3] = viewCorner(vec2(tileMin.x, tileMax.y));
+	vec3 planes[4];
+	for (int i = 0; i < 4; i++)
+		planes[i] = normalize(cross(corners[i], corners[(i + 1) % 4]));
+
+	//a tile without geometry keeps no lights
+	float zMin = uintBitsToFloat(minDepth);
+	float zMax = uintBitsToFloat(maxDepth);
+	//middle of the tile's depth range, lights are ranked by their distance to it
+	vec3 tileCenter = viewCorner((tileMin + tileMax) * 0.5);
+	tileCenter *= (zMin + zMax) * 0.5 / -tileCenter.z;
+
+	//each pass tests one light per thread, then cuts the list back to the nearest lights if it overflowed
+	for (uint first = 0; first < uint(lightCount); first += TILE_THREADS) {
+		uint i = first + gl_LocalInvocationIndex;
+		if (i < uint(lightCount)) {
+			vec3 center = vec3(view * vec4(lights[i].pos, 1.0));
+			float radius = lights[i].radius;
+			bool inside = -center.z + radius >= zMin && -center.z - radius <= zMax;
+			for (int p = 0; p < 4; p++)
+				inside = inside && dot(planes[p], center) <= radius;
+			if (inside) {
+				uint rank = uint(min(length(center - tileCenter) * 64.0, 65535.0));
+				tileList[atomicAdd(tileCount, 1)] = (rank << 16) | (i & 0xFFFFu);
+			}
+		}
+		barrier();
+		uint count = tileCount;
+		if (count > MAX_LIGHTS_PER_TILE) {
+			sortTileList(count);
+			if (gl_LocalInvocationIndex == 0)
+				tileCount = MAX_LIGHTS_PER_TILE;
+		}
+		barrier();
+	}
+
+	uint tile = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+	uint base = tile * (MAX_LIGHTS_PER_TILE + 1);
+	uint count = tileCount;
+	if (gl_LocalInvocationIndex == 0)
+		tileLights[base] = count;
+	for (uint i = gl_LocalInvocationIndex; i < count; i += TILE_THREADS)
+		tileLights[base + 1 + i] = tileList[i] & 0xFFFFu;
+}
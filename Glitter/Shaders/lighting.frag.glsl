@@ -1,15 +1,26 @@
 #version 430 core
+#ifndef LIGHT_TILE_SIZE
+#define LIGHT_TILE_SIZE 16
+#endif
+#ifndef MAX_LIGHTS_PER_TILE
+#define MAX_LIGHTS_PER_TILE 63
+#endif
+#ifndef LIGHT_TILES_X
+#define LIGHT_TILES_X 80
+#endif
 
-#define NUM_LIGHTS 3
+//std430 layout: each vec3 is packed with one of the attenuation constants, matches LightData.
+//Positions are in world space so the buffer doesn't change with the camera.
 struct PointLight {
 	vec3 pos;
 	float a;
+	vec3 ambient;
 	float b;
+	vec3 diffuse;
 	float c;
-	
-	vec3 ambient;
 	vec3 specular;
-	vec3 diffuse;
+	int shadowIndex;
+	float radius;
 };
 
 layout (location = 1) out vec3 radiosity;
@@ -24,33 +35,53 @@ uniform sampler2DArray bufferColor;
 uniform sampler2D bufferOcclusion;
 
 //Lighting information
-uniform samplerCube depthMap[NUM_LIGHTS];
+//shadow cubemaps of all lights
+uniform samplerCubeArray shadowAtlas;
 uniform float farPlane;
-uniform PointLight lights[NUM_LIGHTS];
+//shadow cubemaps and lights are in world space, lighting is done in view space
+uniform mat4 view;
+uniform mat4 invView;
+layout (std430) readonly buffer LightBlock {
+	int lightCount;
+	PointLight lights[];
+};
+//lights reaching into each screen tile, built by lightCulling.comp.glsl
+layout (std430) readonly buffer TileBlock {
+	uint tileLights[];
+};
 
 //display SSAO buffer
 //1 = v
 //2 = SSAO buffer
-uniform int displayMode;
+#ifndef DISPLAY_MODE
+#define DISPLAY_MODE 1
+#endif
 
-vec3 applyPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, float specularColor, float occlusion, int i, out vec3 diffuse)
+vec3 applyPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, float specularColor, float occlusion, out vec3 diffuse)
 {
-	vec3 lightDir = normalize(light.pos - fragPos);
+	vec3 lightPos = vec3(view * vec4(light.pos, 1.0));
+	vec3 lightDir = normalize(lightPos - fragPos);
 
-	//in shadow?
-	vec3 fragToLight = fragPos - light.pos; 
-    float closestDepth = texture(depthMap[i], fragToLight).r;
-	closestDepth *= farPlane;
-	float currentDepth = length(fragToLight);
-    //apply a bias to avoid moire artifacts
-    //float bias = 0.15; 
-	//higher biased the further light dir is from normal
-	float bias = max(0.15 * (1.0 - dot(normal, lightDir)), 0.5);  
-    float shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
+	//in shadow? lights the atlas had no room for have no shadow map
+	float shadow = 0.0;
+	if (light.shadowIndex >= 0) {
+		vec3 fragToLight = fragPos - lightPos; 
+		float closestDepth = texture(shadowAtlas, vec4(mat3(invView) * fragToLight, light.shadowIndex)).r;
+		closestDepth *= farPlane;
+		float currentDepth = length(fragToLight);
+		//apply a bias to avoid moire artifacts
+		//float bias = 0.15; 
+		//higher biased the further light dir is from normal
+		float bias = max(0.15 * (1.0 - dot(normal, lightDir)), 0.5);  
+		shadow = currentDepth - bias > closestDepth ? 1.0 : 0.0;
+	}
 
 	//distance attenuation
-	float dist = length(light.pos - fragPos);
+	float dist = length(lightPos - fragPos);
 	float atten = 1.0/(light.a*dist*dist + light.b*dist + light.c);
+	//fade out to zero at the radius the lights were culled with
+	float window = clamp(1.0 - pow(dist / light.radius, 4.0), 0.0, 1.0);
+	atten *= window * window;
 
 	//diffuse lighting
 	float diff = max(dot(normal, lightDir), 0.0);
@@ -83,18 +114,22 @@ void main()
 	vec3 finalColor = vec3(0,0,0);
 	vec3 finalRadiosity = vec3(0,0,0);
 
-	//add each light
+	//add each light reaching this tile
 	vec3 viewDir = normalize(-FragPos);
 	vec3 lambertian;
-	for(int i = 0; i < NUM_LIGHTS; i++) {
-		finalColor += applyPointLight(lights[i], Normal, FragPos, viewDir, Diffuse, Specular, Occlusion, i, lambertian);
+	uvec2 tile = uvec2(gl_FragCoord.xy) / LIGHT_TILE_SIZE;
+	uint base = (tile.y * LIGHT_TILES_X + tile.x) * (MAX_LIGHTS_PER_TILE + 1);
+	uint count = tileLights[base];
+	for(uint i = 0; i < count; i++) {
+		finalColor += applyPointLight(lights[tileLights[base + 1 + i]], Normal, FragPos, viewDir, Diffuse, Specular, Occlusion, lambertian);
 		finalRadiosity += lambertian;
 	}
 	if(gl_Layer == 0) {
-		if(displayMode == 1)
-			color = vec4(finalColor, 1.0);
-		else if(displayMode == 2)
-			color = vec4(vec3(Occlusion), 1.0);
+#if DISPLAY_MODE == 1
+		color = vec4(finalColor, 1.0);
+#elif DISPLAY_MODE == 2
+		color = vec4(vec3(Occlusion), 1.0);
+#endif
 	}
 	radiosity = finalRadiosity;
 }
\ No newline at end of file
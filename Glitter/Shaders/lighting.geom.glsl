@@ -1,13 +1,18 @@
 #version 430 core
+#ifndef GBUFFER_LAYERS
+#define GBUFFER_LAYERS 2
+#endif
+//one triangle per layer, layout qualifiers can't hold expressions before GLSL 4.40
+#ifndef GBUFFER_MAX_VERTICES
+#define GBUFFER_MAX_VERTICES 6
+#endif
 layout (triangles) in;
-layout (triangle_strip, max_vertices=6) out;
+layout (triangle_strip, max_vertices=GBUFFER_MAX_VERTICES) out;
 
 in vec2 texCoords[];
 
 out vec2 TexCoords;
 
-#define GBUFFER_LAYERS 2
-
 void main()
 {
 	//send triangle to all layers
@@ -0,0 +1,26 @@
+#version 430 core
+//work group size in each dimension
+#ifndef POSITION_PYRAMID_GROUP
+#define POSITION_PYRAMID_GROUP 8
+#endif
+layout (local_size_x = POSITION_PYRAMID_GROUP, local_size_y = POSITION_PYRAMID_GROUP) in;
+
+//G-buffer positions when building level 1, the pyramid itself otherwise
+uniform sampler2DArray source;
+//MIP of the source holding the level above
+uniform int sourceLevel;
+layout (rgba16f) writeonly uniform image2DArray destination;
+
+void main()
+{
+	ivec3 texel = ivec3(gl_GlobalInvocationID);
+	ivec2 size = imageSize(destination).xy;
+	if (texel.x >= size.x || texel.y >= size.y)
+		return;
+
+	//rotated grid subsample: keep one of the four texels above rather than blending positions across edges
+	ivec2 above = texel.xy * 2 + ivec2(texel.y & 1, texel.x & 1);
+	above = min(above, textureSize(source, sourceLevel).xy - 1);
+	vec3 position = texelFetch(source, ivec3(above, texel.z), sourceLevel).xyz;
+	imageStore(destination, texel, vec4(position, 1.0));
+}
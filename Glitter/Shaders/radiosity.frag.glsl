@@ -1,5 +1,6 @@
 #version 330 core
-out vec3 outgoingRadiosity;
+//radiosity in rgb, the fraction of samples that contributed in a
+out vec4 outgoingRadiosity;
 in vec2 TexCoords;
 
 //from gbuffer
@@ -7,31 +8,94 @@ uniform sampler2DArray bufferPosition;
 uniform sampler2DArray bufferNormal;
 //from lighting stage or previous pass
 uniform sampler2DArray bufferRadiosity;
-
-#define NUM_LAYERS 2
-#define NUM_SAMPLES 32
+//diffuse color of the G-buffer, to reflect the previous bounces with
+uniform sampler2DArray bufferColor;
+//last frame's accumulated radiosity of the first layer and the linear depth it was computed at
+uniform sampler2D historyColor;
+uniform sampler2D historyDepth;
+uniform int useHistory;
+//from this frame's camera space to last frame's, and last frame's projection
+uniform mat4 reprojection;
+uniform mat4 prevProjection;
+
+#ifndef GBUFFER_LAYERS
+#define GBUFFER_LAYERS 2
+#endif
+#ifndef RADIOSITY_NUM_SAMPLES
+#define RADIOSITY_NUM_SAMPLES 8
+#endif
 uniform sampler2D texNoise;
-uniform vec3 samples[NUM_SAMPLES];
+//sample kernel, std140 pads each sample to a vec4
+layout (std140) uniform SampleKernel {
+	vec4 samples[RADIOSITY_NUM_SAMPLES];
+};
 uniform mat4 projection;
-
-uniform int which;
+//rotation of the kernel around the normal, changed every frame so the temporal filter accumulates new samples
+uniform float sampleRotation;
+
+//layers radiosity is gathered from: 0 = both, 1 = first only, 2 = second only
+#ifndef WHICH
+#define WHICH 0
+#endif
+#if WHICH == 0
+#define GATHER_LAYERS GBUFFER_LAYERS
+#else
+#define GATHER_LAYERS 1
+#endif
 
 //tiling factor for noise texture
-const vec2 noiseScale = vec2(1000.0/4.0, 800/4.0);
+#ifndef SCREEN_SIZE
+#define SCREEN_SIZE vec2(1000.0, 800.0)
+#endif
+//the pass renders at 1/INDIRECT_DOWNSAMPLE of the G-buffer's resolution
+#ifndef INDIRECT_DOWNSAMPLE
+#define INDIRECT_DOWNSAMPLE 1
+#endif
+//one noise tile per 4x4 rendered pixels
+const vec2 noiseScale = SCREEN_SIZE / (4.0 * INDIRECT_DOWNSAMPLE);
 
 //parameters
 const float radius = 2;
 
+//relative depth difference above which the history belongs to another surface
+const float depthTolerance = 0.05;
+//share of the earlier bounces a surface passes on, on top of its albedo/pi Lambertian reflection.
+//Gathering that back over the hemisphere gives each bounce a gain of about albedo * bounceReflectivity,
+//the margin below 1 covers the sample kernel not being exactly uniform.
+const float bounceReflectivity = 0.5;
+//cap on the earlier bounces fed back, so a bright outlier in the history can't spread
+const float maxBounce = 1.0;
+
 #define M_PI 3.1415926535897932384626433832795
 
+//Radiosity that reached Y in previous frames, so every frame gathers one more bounce
+vec3 previousBounces(vec3 posY)
+{
+	vec4 prevPosition = reprojection * vec4(posY, 1.0);
+	vec4 prevClip = prevProjection * prevPosition;
+	vec2 prevCoords = prevClip.xy / prevClip.w * 0.5 + 0.5;
+	if (prevClip.w <= 0.0 || any(lessThan(prevCoords, vec2(0.0))) || any(greaterThan(prevCoords, vec2(1.0))))
+		return vec3(0.0);
+	//history pixel q was computed at G-buffer texel q * INDIRECT_DOWNSAMPLE, so a still camera reads q exactly
+	ivec2 size = textureSize(historyDepth, 0);
+	vec2 historyCoords = ((prevCoords * SCREEN_SIZE - 0.5) / INDIRECT_DOWNSAMPLE + 0.5) / vec2(size);
+	float storedDepth = texelFetch(historyDepth, clamp(ivec2(historyCoords * size), ivec2(0), size - 1), 0).r;
+	if (abs(storedDepth + prevPosition.z) >= depthTolerance * storedDepth)
+		return vec3(0.0);
+	return texture(historyColor, historyCoords).rgb;
+}
+
 void main()
 {
 	//get normal/position of closest layer (X)
-	vec3 posX = texture(bufferPosition, vec3(TexCoords, 0)).xyz;
-	vec3 normalX = normalize(texture(bufferNormal, vec3(TexCoords, 0)).xyz);
+	//at reduced resolution this is the top left G-buffer texel of the pixel, which the blur and upsample use as its guide
+	ivec3 texel = ivec3(ivec2(gl_FragCoord.xy) * INDIRECT_DOWNSAMPLE, 0);
+	vec3 posX = texelFetch(bufferPosition, texel, 0).xyz;
+	vec3 normalX = normalize(texelFetch(bufferNormal, texel, 0).xyz);
 
 	//create matrix to rotate sample kernel a random amount using noise texture
 	vec3 noise = normalize(texture(texNoise, TexCoords * noiseScale).xyz);
+	noise.xy = mat2(cos(sampleRotation), sin(sampleRotation), -sin(sampleRotation), cos(sampleRotation)) * noise.xy;
 	vec3 tangent = normalize(noise - normalX * dot(noise, normalX));
 	vec3 bitangent = cross(normalX, tangent);
 	mat3 T = mat3(tangent, bitangent, normalX);
@@ -40,10 +104,12 @@ void main()
 	//but only the M which (w*nx) > 0 and (w*ny) < 0 (aka the non-zero ones)
 	int M = 0;
 	vec3 irradiance = vec3(0);
-	for(int i = 0; i < NUM_SAMPLES; i++)
+	//from the earlier bounces, kept apart so the saturation boost doesn't amplify the feedback
+	vec3 bounceIrradiance = vec3(0);
+	for(int i = 0; i < RADIOSITY_NUM_SAMPLES; i++)
 	{
 		//rotate sample
-		vec3 samplePos = T * samples[i];
+		vec3 samplePos = T * samples[i].xyz;
 		//add this offset to fragment position
 		samplePos = posX + samplePos * radius; 
 
@@ -53,16 +119,23 @@ void main()
 		coords.xyz /= coords.w;
 		coords.xyz = coords.xyz * 0.5 + 0.5;
 
-		for(int j = 0; j < NUM_LAYERS; j++) 
+		for(int j = 0; j < GBUFFER_LAYERS; j++) 
 		{
-			if(which == 1 && j == 1)
+#if WHICH == 1
+			if(j == 1)
 				continue;
-			else if(which == 2 && j == 0)
+#elif WHICH == 2
+			if(j == 0)
 				continue;
+#endif
 			//look at position in given layer at these screen coordinates (Y)
 			vec3 posY = texture(bufferPosition, vec3(coords.xy, j)).xyz;
 			//get outgoing radiosity from this point (B(Y))
 			vec3 radiosityY = texture(bufferRadiosity, vec3(coords.xy, j)).xyz;
+			//and what it reflects of the earlier bounces (Lambertian), only known for the first layer
+			vec3 bounceY = vec3(0);
+			if (j == 0 && useHistory != 0)
+				bounceY = texture(bufferColor, vec3(coords.xy, j)).rgb / M_PI * min(previousBounces(posY), vec3(maxBounce));
 			//get normal of this point Ny
 			vec3 normalY = texture(bufferNormal, vec3(coords.xy, j)).xyz;
 
@@ -75,26 +148,26 @@ void main()
 			int use = ((facingX > 0) && (facingY < 0)) ? 1 : 0;
 			//scale by how close it's facing normalX
 			radiosityY *= max(facingX, 0);
+			bounceY *= max(facingX, 0);
 			//add radiosity from this sample
 			irradiance += (use == 1) ? radiosityY : 0;
+			bounceIrradiance += (use == 1) ? bounceY : vec3(0);
 			M += use;
 		}
 	}
 	//normalize
-	irradiance *= (2 * M_PI) / M;
+	irradiance *= M > 0 ? (2 * M_PI) / M : 0.0;
 	irradiance = max(irradiance, 0);
+	bounceIrradiance *= M > 0 ? bounceReflectivity * (2 * M_PI) / M : 0.0;
 
 	//boost saturated colors
 	float maxChannel = max(irradiance.r, max(irradiance.g, irradiance.b));
 	float minChannel = min(irradiance.r, min(irradiance.g, irradiance.b));
-	float boost = maxChannel - minChannel / maxChannel;
+	float boost = maxChannel > 0 ? maxChannel - minChannel / maxChannel : 0.0;
 
 	//reflectivity (can be per material)
 	float reflectivity = 1;
 
-	//convert to outgoing radiance
-	outgoingRadiosity = irradiance * reflectivity * boost; 
-
-	//confidence value
-	//confidence = M / NUM_SAMPLES;
+	//convert to outgoing radiance, with the confidence value
+	outgoingRadiosity = vec4((irradiance * boost + bounceIrradiance) * reflectivity, float(M) / (RADIOSITY_NUM_SAMPLES * GATHER_LAYERS));
 }
\ No newline at end of file
@@ -0,0 +1,66 @@
+#version 430 core
+//the input is at 1/INDIRECT_DOWNSAMPLE of the G-buffer's resolution
+#ifndef INDIRECT_DOWNSAMPLE
+#define INDIRECT_DOWNSAMPLE 1
+#endif
+//work group size in each dimension
+#ifndef TEMPORAL_GROUP
+#define TEMPORAL_GROUP 8
+#endif
+layout (local_size_x = TEMPORAL_GROUP, local_size_y = TEMPORAL_GROUP) in;
+
+//this frame's radiosity, with its confidence in alpha
+uniform sampler2D bufferInput;
+//last frame's accumulated radiosity and confidence, and the linear depth it was computed at
+uniform sampler2D historyColor;
+uniform sampler2D historyDepth;
+//first layer of the G-buffer
+uniform sampler2DArray bufferPosition;
+uniform int useHistory;
+uniform mat4 invView;
+uniform mat4 prevView;
+uniform mat4 prevProjection;
+layout (rgba16f) writeonly uniform image2D outputColor;
+layout (r32f) writeonly uniform image2D outputDepth;
+
+//cap on the accumulated confidence, about as many frames of full confidence, so lighting changes still get through
+const float maxConfidence = 16.0;
+//relative depth difference above which the history belongs to another surface
+const float depthTolerance = 0.05;
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(outputColor);
+	if (pixel.x >= size.x || pixel.y >= size.y)
+		return;
+
+	vec4 current = texelFetch(bufferInput, pixel, 0);
+	//the G-buffer texel the radiosity pass shaded this pixel at
+	vec3 position = texelFetch(bufferPosition, ivec3(pixel * INDIRECT_DOWNSAMPLE, 0), 0).xyz;
+
+	//where this point was on screen last frame
+	vec4 prevPosition = prevView * (invView * vec4(position, 1.0));
+	vec4 prevClip = prevProjection * prevPosition;
+	vec2 prevCoords = prevClip.xy / prevClip.w * 0.5 + 0.5;
+
+	vec3 history = vec3(0.0);
+	float historyConfidence = 0.0;
+	if (useHistory != 0 && prevClip.w > 0.0 && all(greaterThanEqual(prevCoords, vec2(0.0))) && all(lessThanEqual(prevCoords, vec2(1.0)))) {
+		//history pixel q was computed at G-buffer texel q * INDIRECT_DOWNSAMPLE, so a still camera reads q exactly
+		vec2 fullSize = vec2(textureSize(bufferPosition, 0).xy);
+		vec2 historyCoords = ((prevCoords * fullSize - 0.5) / INDIRECT_DOWNSAMPLE + 0.5) / vec2(size);
+		//only keep the history if it was computed on the same surface
+		float storedDepth = texelFetch(historyDepth, clamp(ivec2(historyCoords * size), ivec2(0), size - 1), 0).r;
+		if (abs(storedDepth + prevPosition.z) < depthTolerance * storedDepth) {
+			vec4 previous = texture(historyColor, historyCoords);
+			history = previous.rgb;
+			historyConfidence = previous.a;
+		}
+	}
+
+	float confidence = historyConfidence + current.a;
+	vec3 result = confidence > 0.0 ? (history * historyConfidence + current.rgb * current.a) / confidence : current.rgb;
+	imageStore(outputColor, pixel, vec4(result, min(confidence, maxConfidence)));
+	imageStore(outputDepth, pixel, vec4(-position.z));
+}
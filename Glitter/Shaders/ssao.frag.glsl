@@ -1,17 +1,41 @@
-#version 330 core
+#version 430 core
 out float color;
 in vec2 TexCoords;
 
 uniform sampler2DArray bufferPosition;
 uniform sampler2DArray bufferNormal;
 uniform sampler2D texNoise;
+//coarser positions of all layers for distant samples, its mip i is pyramid level i + 1
+uniform sampler2DArray bufferPositionMips;
 
-#define NUM_SAMPLES 32
-uniform vec3 samples[NUM_SAMPLES];
+#ifndef SSAO_NUM_SAMPLES
+#define SSAO_NUM_SAMPLES 32
+#endif
+#ifndef GBUFFER_LAYERS
+#define GBUFFER_LAYERS 2
+#endif
+//sample kernel, std140 pads each sample to a vec4
+layout (std140) uniform SampleKernel {
+	vec4 samples[SSAO_NUM_SAMPLES];
+};
 uniform mat4 projection;
 
 //tiling factor for noise texture
-const vec2 noiseScale = vec2(1000.0/4.0, 800/4.0);
+#ifndef SCREEN_SIZE
+#define SCREEN_SIZE vec2(1000.0, 800.0)
+#endif
+//the pass renders at 1/INDIRECT_DOWNSAMPLE of the G-buffer's resolution
+#ifndef INDIRECT_DOWNSAMPLE
+#define INDIRECT_DOWNSAMPLE 1
+#endif
+//one noise tile per 4x4 rendered pixels
+const vec2 noiseScale = SCREEN_SIZE / (4.0 * INDIRECT_DOWNSAMPLE);
+
+#ifndef POSITION_PYRAMID_LEVELS
+#define POSITION_PYRAMID_LEVELS 5
+#endif
+//samples within 2^LOG_MAX_OFFSET pixels read level 0, each doubling of the distance goes one level coarser
+#define LOG_MAX_OFFSET 3
 
 //parameters
 const float radius = 2;
@@ -23,7 +47,7 @@ const float epsilon = 0.000001;
 
 float aoLayer(int i, int j, mat3 T, vec3 fragPos, vec3 fragNormal) {
 	//rotate sample
-	vec3 samplePos = T * samples[i];
+	vec3 samplePos = T * samples[i].xyz;
 	//add this offset to fragment position
 	samplePos = fragPos + samplePos * radius; 
 
@@ -33,8 +57,17 @@ float aoLayer(int i, int j, mat3 T, vec3 fragPos, vec3 fragNormal) {
 	coords.xyz /= coords.w;
 	coords.xyz = coords.xyz * 0.5 + 0.5;
 
-	//look at position in given layer at these screen coordinates (Y)
-	vec3 layerPos = texture(bufferPosition, vec3(coords.xy, j)).xyz;
+	//pick the MIP level by how far the sample lands from the pixel on screen
+	float screenDistance = length((coords.xy - TexCoords) * SCREEN_SIZE);
+	int mip = clamp(int(floor(log2(max(screenDistance, 1.0)))) - LOG_MAX_OFFSET, 0, POSITION_PYRAMID_LEVELS - 1);
+	ivec2 texel = ivec2(coords.xy * SCREEN_SIZE) >> mip;
+
+	//look at position in given layer at these screen coordinates (Y), full resolution comes straight from the G-buffer
+	vec3 layerPos;
+	if (mip == 0)
+		layerPos = texelFetch(bufferPosition, ivec3(clamp(texel, ivec2(0), textureSize(bufferPosition, 0).xy - 1), j), 0).xyz;
+	else
+		layerPos = texelFetch(bufferPositionMips, ivec3(clamp(texel, ivec2(0), textureSize(bufferPositionMips, mip - 1).xy - 1), j), mip - 1).xyz;
 
 	//v = Y - X
 	vec3 v = layerPos - fragPos;
@@ -45,8 +78,10 @@ float aoLayer(int i, int j, mat3 T, vec3 fragPos, vec3 fragNormal) {
 void main()
 {
 	//get normal/position of closest layer (X)
-	vec3 fragPos = texture(bufferPosition, vec3(TexCoords, 0)).xyz;
-	vec3 normal = normalize(texture(bufferNormal, vec3(TexCoords, 0)).xyz);
+	//at reduced resolution this is the top left G-buffer texel of the pixel, which the blur and upsample use as its guide
+	ivec3 texel = ivec3(ivec2(gl_FragCoord.xy) * INDIRECT_DOWNSAMPLE, 0);
+	vec3 fragPos = texelFetch(bufferPosition, texel, 0).xyz;
+	vec3 normal = normalize(texelFetch(bufferNormal, texel, 0).xyz);
 
 	//create matrix to rotate sample kernel a random amount using noise texture
 	vec3 noise = normalize(texture(texNoise, TexCoords * noiseScale).xyz);
@@ -56,11 +91,14 @@ void main()
 
 	//take samples
 	float occlusion = 0.0;
-	for(int i = 0; i < NUM_SAMPLES; i++)
+	for(int i = 0; i < SSAO_NUM_SAMPLES; i++)
 	{
 		//use whichever layer gives highest value (aka closest)
-		occlusion += max(0, max(aoLayer(i, 0, T, fragPos, normal), aoLayer(i, 1, T, fragPos, normal)));
+		float layerOcclusion = 0.0;
+		for(int j = 0; j < GBUFFER_LAYERS; j++)
+			layerOcclusion = max(layerOcclusion, aoLayer(i, j, T, fragPos, normal));
+		occlusion += layerOcclusion;
 	}
 	//normalize occlusion factor and convert to ambient visibility
-	color = max(0, 1 - sqrt(occlusion * M_PI / NUM_SAMPLES));
+	color = max(0, 1 - sqrt(occlusion * M_PI / SSAO_NUM_SAMPLES));
 }
\ No newline at end of file
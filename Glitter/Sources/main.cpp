@@ -7,6 +7,7 @@
 // Standard Headers
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 
 //// Helper functions
@@ -17,17 +18,28 @@
 
 // My Additions
 #include "light.hpp"
+#include "lightbuffer.hpp"
+#include "shadowatlas.hpp"
+#include "lightculling.hpp"
+#include "positionpyramid.hpp"
 #include "gbuffer.hpp"
+#include "gbufferreference.hpp"
 #include "ambientocclusionbuffer.hpp"
 #include "blurbuffer.hpp"
 #include "environmentmap.hpp"
 #include "radiositybuffer.hpp"
+#include "radiosityhistory.hpp"
+#include "allocationcounter.hpp"
+#include "glstate.hpp"
+#include "gputimer.hpp"
 
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 
+int Run(GLFWwindow* mWindow);
+
 void RenderCube();
 void RenderQuad();
 
@@ -39,13 +51,44 @@ Camera camera(glm::vec3(0.f, 0.f, 2.f));
 int displayMode = 1;
 int useRadiosity = 0; //turns radiosity on/off
 int whichRad = 0; //radiosity from both, first layer only, second layer only
+bool useTemporal = true; //accumulate radiosity over frames
+bool useBounces = true; //gather last frame's radiosity as further bounces
+// Golden angle, the kernel is rotated by it every frame so accumulated frames don't repeat samples
+#define SAMPLE_ROTATION_STEP 2.39996323f
 
+// Lights created at startup, the first three are placed by hand and the rest scattered through the scene
+#ifndef NUM_LIGHTS
 #define NUM_LIGHTS 3
+#endif
 #define MOVE_LIGHT_SPEED 0.5f
-Light lights[NUM_LIGHTS];
+std::vector<Light> lights;
 int moveLight = 0; // Which light to control
 
+// How the shadow cubemaps are drawn
+#define SHADOW_GEOMETRY_SHADER 0 //layered, the geometry shader emits every triangle to all six faces
+#define SHADOW_GEOMETRY_SHADER_CULLED 1 //layered, triangles are only emitted to the faces they overlap
+#define SHADOW_PER_FACE 2 //one draw per face of the meshes overlapping it
+#define SHADOW_MODES 3
+int shadowMode = SHADOW_PER_FACE;
+bool forceShadows = false; //redraw all shadow maps every frame, for timing them
+// With --shadow-benchmark N, redraw all shadows for N frames in each mode, print their timings and exit
+size_t shadowBenchmarkFrames = 0;
+bool printStats = false;
+
+// How the second G-buffer layer is separated from the first, one of the GBUFFER_ modes
+int gbufferMode = GBUFFER_REPROJECT;
+bool measureError = false; //compare the second layer against an exact depth peeled reference every frame
+
+// With --frames N, exit after rendering N frames past the allocation warm-up instead of waiting for the window to close
+size_t exitAfterFrames = 0;
+
 int main(int argc, char * argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			exitAfterFrames = strtoul(argv[++i], nullptr, 10);
+		else if (strcmp(argv[i], "--shadow-benchmark") == 0 && i + 1 < argc)
+			shadowBenchmarkFrames = strtoul(argv[++i], nullptr, 10);
+	}
 	srand(time(0));
     // Load GLFW and Create a Window
     glfwInit();
@@ -73,37 +116,105 @@ int main(int argc, char * argv[]) {
 	glfwSetScrollCallback(mWindow, scroll_callback);
 	glfwSetInputMode(mWindow, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
+	int result = Run(mWindow);
+	glfwTerminate();
+	return result;
+}
+
+// Creates the GL objects and runs the rendering loop, they are destroyed on return while the context still exists
+int Run(GLFWwindow* mWindow) {
 	glEnable(GL_DEPTH_TEST);
 
 	// Create G-Buffer for deferred shading
 	GBuffer gbuffer;
 	// Create buffers and textures for SSAO and SSDO
 	AmbientOcclusionBuffer ssao;
+	// MIP pyramid of the G-buffer positions for the SSAO samples
+	PositionPyramid positionPyramid;
 	// Buffer and textures to blur SSAO buffer before using it in the lighting pass
 	BlurBuffer blur;
 	// Create buffers for Radiosity
 	RadiosityBuffer radiosity;
-
-	// Shader for rendering to shadow depth maps (first 3 passes)
-	Shader depthShader(FileSystem::getPath("Shaders/depthMap.vert.glsl").c_str(), FileSystem::getPath("Shaders/depthMap.frag.glsl").c_str(), FileSystem::getPath("Shaders/depthMap.geom.glsl").c_str());
+	// Radiosity of previous frames, reprojected and blended with the new one
+	RadiosityHistory radiosityHistory;
+
+	// Constants shared with the shaders, compiled into them instead of duplicated by hand
+	ShaderDefines defines;
+	defines.Set("GBUFFER_LAYERS", GBUFFER_LAYERS);
+	defines.Set("GBUFFER_MAX_VERTICES", 3 * GBUFFER_LAYERS);
+	defines.Set("SSAO_NUM_SAMPLES", SSAO_NUM_SAMPLES);
+	defines.Set("RADIOSITY_NUM_SAMPLES", RADIOSITY_NUM_SAMPLES);
+	defines.Set("LIGHT_TILE_SIZE", LIGHT_TILE_SIZE);
+	defines.Set("MAX_LIGHTS_PER_TILE", MAX_LIGHTS_PER_TILE);
+	defines.Set("LIGHT_TILES_X", LIGHT_TILES_X);
+	defines.Set("POSITION_PYRAMID_LEVELS", POSITION_PYRAMID_LEVELS);
+	defines.Set("POSITION_PYRAMID_GROUP", POSITION_PYRAMID_GROUP);
+	defines.Set("BLUR_GROUP", BLUR_GROUP);
+	defines.Set("UPSAMPLE_GROUP", UPSAMPLE_GROUP);
+	defines.Set("TEMPORAL_GROUP", TEMPORAL_GROUP);
+	defines.Set("GBUFFER_ERROR_GROUP", GBUFFER_ERROR_GROUP);
+	defines.Set("MINIMUM_SEPARATION", MINIMUM_SEPARATION);
+	defines.Set("GBUFFER_ERROR_BINDING", GBUFFER_ERROR_BINDING);
+	defines.Set("INDIRECT_DOWNSAMPLE", INDIRECT_DOWNSAMPLE);
+	defines.Set("SCREEN_SIZE", "vec2(" + std::to_string(mWidth) + ".0, " + std::to_string(mHeight) + ".0)");
+
+	// Shaders for rendering to shadow depth maps (first 3 passes), layered with and without per-face culling, or one face at a time
+	Shader* depthShaders[2];
+	for (int cull = 0; cull < 2; cull++) {
+		depthShaders[cull] = &Shader::Get(FileSystem::getPath("Shaders/depthMap.vert.glsl").c_str(), FileSystem::getPath("Shaders/depthMap.frag.glsl").c_str(), FileSystem::getPath("Shaders/depthMap.geom.glsl").c_str(), ShaderDefines().Set("CULL_FACES", cull));
+		depthShaders[cull]->BindStorageBlock("ShadowBlock", SHADOW_BUFFER_BINDING);
+	}
+	Shader depthFaceShader(FileSystem::getPath("Shaders/depthMapFace.vert.glsl").c_str(), FileSystem::getPath("Shaders/depthMap.frag.glsl").c_str());
 	// Shader for first pass to gbuffer
-	Shader geometryShader(FileSystem::getPath("Shaders/geometry.vert.glsl").c_str(), FileSystem::getPath("Shaders/geometry.frag.glsl").c_str(), FileSystem::getPath("Shaders/geometry.geom.glsl").c_str());
+	Shader geometryShader(FileSystem::getPath("Shaders/geometry.vert.glsl").c_str(), FileSystem::getPath("Shaders/geometry.frag.glsl").c_str(), FileSystem::getPath("Shaders/geometry.geom.glsl").c_str(), defines);
+	// Shader for building the position pyramid read by the SSAO pass
+	Shader positionMipShader(FileSystem::getPath("Shaders/positionMip.comp.glsl").c_str(), defines);
 	// Shader for second pass (SSAO)
-	Shader ssaoShader(FileSystem::getPath("Shaders/ssao.vert.glsl").c_str(), FileSystem::getPath("Shaders/ssao.frag.glsl").c_str());
+	Shader ssaoShader(FileSystem::getPath("Shaders/ssao.vert.glsl").c_str(), FileSystem::getPath("Shaders/ssao.frag.glsl").c_str(), nullptr, defines);
 	// Shader for third pass (blurring SSAO)
-	Shader blurShader(FileSystem::getPath("Shaders/ssao.vert.glsl").c_str(), FileSystem::getPath("Shaders/blur.frag.glsl").c_str());
-	// Shader for fourth pass (lighting)
-	Shader lightingShader(FileSystem::getPath("Shaders/lighting.vert.glsl").c_str(), FileSystem::getPath("Shaders/lighting.frag.glsl").c_str(), FileSystem::getPath("Shaders/lighting.geom.glsl").c_str());
-	// Shader for fifth pass (radiosity)
-	Shader radiosityShader(FileSystem::getPath("Shaders/ssao.vert.glsl").c_str(), FileSystem::getPath("Shaders/radiosity.frag.glsl").c_str());
+	Shader blurShader(FileSystem::getPath("Shaders/bilateralBlur.comp.glsl").c_str(), ShaderDefines(defines).Set("BLUR_FORMAT", "r16f"));
+	// Shader for bringing the blurred SSAO to screen resolution when it's computed at a lower one
+	Shader upsampleShader(FileSystem::getPath("Shaders/bilateralUpsample.comp.glsl").c_str(), ShaderDefines(defines).Set("BLUR_FORMAT", "r16f"));
+	// Shader for building the per-tile light lists the lighting pass loops over
+	Shader lightCullingShader(FileSystem::getPath("Shaders/lightCulling.comp.glsl").c_str(), defines);
+	// Shader for fourth pass (lighting), one permutation per display mode
+	Shader* lightingShaders[DISPLAY_SSAO_BUFFER + 1] = { nullptr };
+	for (int mode = DISPLAY_SSAO; mode <= DISPLAY_SSAO_BUFFER; mode++)
+		lightingShaders[mode] = &Shader::Get(FileSystem::getPath("Shaders/lighting.vert.glsl").c_str(), FileSystem::getPath("Shaders/lighting.frag.glsl").c_str(), FileSystem::getPath("Shaders/lighting.geom.glsl").c_str(), ShaderDefines(defines).Set("DISPLAY_MODE", mode));
+	// Shader for fifth pass (radiosity), one permutation per choice of layers to gather from
+	Shader* radiosityShaders[3];
+	for (int which = 0; which < 3; which++)
+		radiosityShaders[which] = &Shader::Get(FileSystem::getPath("Shaders/ssao.vert.glsl").c_str(), FileSystem::getPath("Shaders/radiosity.frag.glsl").c_str(), nullptr, ShaderDefines(defines).Set("WHICH", which));
+	// Shader for accumulating radiosity over frames
+	Shader temporalShader(FileSystem::getPath("Shaders/radiosityTemporal.comp.glsl").c_str(), defines);
+	// Shader for blurring radiosity before the sixth pass
+	Shader blurColorShader(FileSystem::getPath("Shaders/bilateralBlur.comp.glsl").c_str(), ShaderDefines(defines).Set("BLUR_FORMAT", "rgba16f"));
+	Shader upsampleColorShader(FileSystem::getPath("Shaders/bilateralUpsample.comp.glsl").c_str(), ShaderDefines(defines).Set("BLUR_FORMAT", "rgba16f"));
 	Shader blurRadiosityShader(FileSystem::getPath("Shaders/ssao.vert.glsl").c_str(), FileSystem::getPath("Shaders/combine.frag.glsl").c_str());
 	// Shader for fifth pass (rendering light sources as white cubes)
 	Shader lightSourceShader(FileSystem::getPath("Shaders/geometry.vert.glsl").c_str(), FileSystem::getPath("Shaders/lightSource.frag.glsl").c_str());
 	// Shader for sixth pass (rendering environment map as a cube at infinity)
 	Shader envShader(FileSystem::getPath("Shaders/envMap.vert.glsl").c_str(), FileSystem::getPath("Shaders/envMap.frag.glsl").c_str());
+	// Shaders for the depth-only first layer and depth peeled second layer, and for comparing the G-buffer against them
+	Shader depthPrepassShader(FileSystem::getPath("Shaders/depthPrepass.vert.glsl").c_str(), FileSystem::getPath("Shaders/depthPrepass.frag.glsl").c_str());
+	Shader depthPeelShader(FileSystem::getPath("Shaders/depthPrepass.vert.glsl").c_str(), FileSystem::getPath("Shaders/depthPeel.frag.glsl").c_str(), nullptr, defines);
+	Shader gbufferErrorShader(FileSystem::getPath("Shaders/gbufferError.comp.glsl").c_str(), defines);
+
+	// Kernels and lights are read from uniform buffers
+	ssaoShader.BindUniformBlock("SampleKernel", SSAO_KERNEL_BINDING);
+	for (int which = 0; which < 3; which++)
+		radiosityShaders[which]->BindUniformBlock("SampleKernel", RADIOSITY_KERNEL_BINDING);
+	for (int mode = DISPLAY_SSAO; mode <= DISPLAY_SSAO_BUFFER; mode++) {
+		lightingShaders[mode]->BindStorageBlock("LightBlock", LIGHT_BUFFER_BINDING);
+		lightingShaders[mode]->BindStorageBlock("TileBlock", TILE_BUFFER_BINDING);
+	}
+	lightCullingShader.BindStorageBlock("LightBlock", LIGHT_BUFFER_BINDING);
+	lightCullingShader.BindStorageBlock("TileBlock", TILE_BUFFER_BINDING);
 
 	// Load a model from obj file
-	Model sampleModel(FileSystem::getPath("Resources/crytek_sponza/sponza.obj").c_str());
+	// The G-buffer pass reads positions, normals and UVs, the shadow pass only positions, so quantize just those
+	// and give the shadow pass its own position-only stream
+	Model sampleModel(FileSystem::getPath("Resources/crytek_sponza/sponza.obj").c_str(), false, VERTEX_POSITION | VERTEX_NORMAL | VERTEX_TEXCOORDS | VERTEX_PACKED | VERTEX_POSITION_STREAM);
 
 	// Load environment map
 	std::vector<std::string> mapFiles;
@@ -116,69 +227,173 @@ int main(int argc, char * argv[]) {
 	EnvironmentMap envMap(mapFiles);
 
 	// Create lights
-	lights[0] = Light(glm::vec3(0, 5, 0), glm::vec3(1, 1, 1), 0.0019, 0.022, 1.0, 0);
-	lights[1] = Light(glm::vec3(52, 5, 10), glm::vec3(1, 1, 1), 0.0019, 0.022, 1.0, 1);
-	lights[2] = Light(glm::vec3(-25, 35, -8), glm::vec3(1, 1, 1), 0.0007, 0.0014, 1.0, 2);
+	lights.push_back(Light(glm::vec3(0, 5, 0), glm::vec3(1, 1, 1), 0.0019, 0.022, 1.0, 0));
+	lights.push_back(Light(glm::vec3(52, 5, 10), glm::vec3(1, 1, 1), 0.0019, 0.022, 1.0, 1));
+	lights.push_back(Light(glm::vec3(-25, 35, -8), glm::vec3(1, 1, 1), 0.0007, 0.0014, 1.0, 2));
+	glm::vec3 lightsMin, lightsMax;
+	sampleModel.WorldBounds(glm::scale(glm::mat4(), glm::vec3(0.05f)), lightsMin, lightsMax);
+	// The scattered lights fall off quickly, so each only reaches the tiles around it
+	while (lights.size() < NUM_LIGHTS) {
+		glm::vec3 t(rand() / (float)RAND_MAX, rand() / (float)RAND_MAX, rand() / (float)RAND_MAX);
+		glm::vec3 color(0.5f + 0.5f * rand() / (float)RAND_MAX, 0.5f + 0.5f * rand() / (float)RAND_MAX, 0.5f + 0.5f * rand() / (float)RAND_MAX);
+		lights.push_back(Light(glm::mix(lightsMin, lightsMax, t), color, 0.25, 0.1, 1.0, lights.size()));
+	}
+	lights.resize(NUM_LIGHTS);
+	// Shadow cubemaps live in one array with room for MAX_SHADOWED_LIGHTS, all light properties in one buffer.
+	// The hand-placed lights are assigned first, scattered lights past the capacity are unshadowed.
+	ShadowAtlas shadowAtlas(std::min<GLuint>(lights.size(), MAX_SHADOWED_LIGHTS));
+	for (GLuint i = 0; i < lights.size(); i++)
+		shadowAtlas.Assign(lights[i]);
+	LightBuffer lightBuffer(lights.size());
+	LightCulling lightCulling;
 
 	// Background Fill Color
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+	// Setup bound objects directly, start tracking from a clean slate
+	GLState::Invalidate();
+
+	// GPU time of the shadow pass in each mode
+	GPUTimer shadowTimers[SHADOW_MODES];
+	GLuint shadowMeshes = 0;
+	if (shadowBenchmarkFrames > 0) {
+		shadowMode = 0;
+		forceShadows = true;
+	}
+	// GPU time of generating the G-buffer in each mode, and its error against the exact two layers
+	GPUTimer gbufferTimers[GBUFFER_MODES];
+	GBufferReference gbufferReference;
+
+	// Camera of the last frame's input, GBUFFER_DELAY renders one frame behind it
+	glm::mat4 delayedView = camera.GetViewMatrix();
+
+	// Frames rendered so far, frames after the warm-up must not allocate
+	size_t frame = 0;
+
     // Rendering Loop
     while (glfwWindowShouldClose(mWindow) == false) {
+		size_t allocations = AllocationCounter::Count();
 		glfwPollEvents();
 
 		//mvp matrices
 		glm::mat4 model;
-		glm::mat4 view = camera.GetViewMatrix();
+		glm::mat4 inputView = camera.GetViewMatrix();
+		//one frame of latency lets the delay mode render next frame's first layer ahead of time
+		glm::mat4 view = gbufferMode == GBUFFER_DELAY ? delayedView : inputView;
+		delayedView = inputView;
 		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (GLfloat)mWidth / (GLfloat)mHeight, mNear, mFar);
 
-		//render to each light's depth cubemap
-		depthShader.Use();
-		for (int i = 0; i < NUM_LIGHTS; i++) {
-			lights[i].BindFramebuffer(depthShader, view);
-			model = glm::mat4();
-			model = glm::scale(model, glm::vec3(0.05f));    // The sponza model is too big, scale it first
-			glUniformMatrix4fv(glGetUniformLocation(depthShader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-			glUniformMatrix4fv(glGetUniformLocation(depthShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-			sampleModel.Draw(depthShader);
+		//permutations for the current display settings
+		Shader& lightingShader = *lightingShaders[displayMode];
+		Shader& radiosityShader = *radiosityShaders[whichRad];
+
+		//bind the uniform buffers for this frame, the light block is only re-uploaded if it changed
+		lightBuffer.Update(lights);
+		lightBuffer.Bind();
+		ssao.BindKernel();
+		radiosity.BindKernel();
+
+		//render to the shadow atlas cubemaps of the lights whose shadows changed, they are kept in world space across frames
+		model = glm::mat4();
+		model = glm::scale(model, glm::vec3(0.05f));    // The sponza model is too big, scale it first
+		glm::vec3 sceneMin, sceneMax;
+		sampleModel.WorldBounds(model, sceneMin, sceneMax);
+		shadowTimers[shadowMode].Begin();
+		shadowMeshes = 0;
+		shadowAtlas.Begin();
+		for (GLuint i = 0; i < lights.size(); i++) {
+			if (lights[i].ShadowIndex() < 0)
+				continue;
+			if (forceShadows)
+				lights[i].InvalidateShadow();
+			if (!lights[i].ShadowNeedsUpdate(model, sceneMin, sceneMax))
+				continue;
+			lights[i].BeginShadow(model, sceneMin, sceneMax);
+			if (shadowAtlas.Add(lights[i]))
+				lights[i].MarkShadowQueued();
+		}
+		if (shadowAtlas.Pending() > 0) {
+			if (shadowMode == SHADOW_PER_FACE) {
+				for (GLuint i = 0; i < shadowAtlas.Pending(); i++) {
+					for (GLuint face = 0; face < 6; face++) {
+						shadowAtlas.BindFace(depthFaceShader, i, face, model);
+						shadowMeshes += sampleModel.DrawDepthCulled(shadowAtlas.FaceTransform(i, face) * model);
+					}
+				}
+			}
+			else {
+				//one layered pass for all of them, instance i draws shadow i
+				shadowAtlas.BindLayered(*depthShaders[shadowMode == SHADOW_GEOMETRY_SHADER_CULLED], model);
+				sampleModel.DrawDepth(shadowAtlas.Pending());
+				shadowMeshes += sampleModel.meshes.size() * shadowAtlas.Pending();
+			}
 		}
+		shadowTimers[shadowMode].End();
 
-		//1st pass: render to gbuffer
+		//1st pass: render to gbuffer, the second layer is separated from a first layer chosen by the mode
+		gbufferTimers[gbufferMode].Begin();
+		geometryShader.Use();
+		gbuffer.SwapAndBindDepthCompareLayer(geometryShader, view, projection, gbufferMode);
 		gbuffer.BindFramebuffer();
-		gbuffer.CopyAndBindDepthCompareLayer(geometryShader);
 		glViewport(0, 0, mWidth, mHeight);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		//render model
-		geometryShader.Use();
-		glUniform1f(glGetUniformLocation(geometryShader.Program, "farPlane"), mFar);
-		glUniform1f(glGetUniformLocation(geometryShader.Program, "nearPlane"), mNear);
-		glUniformMatrix4fv(glGetUniformLocation(geometryShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-		glUniformMatrix4fv(glGetUniformLocation(geometryShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+		geometryShader.SetFloat("farPlane", mFar);
+		geometryShader.SetFloat("nearPlane", mNear);
+		geometryShader.SetMat4("projection", projection);
+		geometryShader.SetMat4("view", view);
 		model = glm::mat4();
 		model = glm::scale(model, glm::vec3(0.05f));    // The sponza model is too big, scale it first
-		glUniformMatrix4fv(glGetUniformLocation(geometryShader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-		sampleModel.Draw(geometryShader);
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		geometryShader.SetMat4("model", model);
+		if (gbufferMode == GBUFFER_TWO_PASS) {
+			//depth peeling: the first layer, then the second against its depth
+			geometryShader.SetInt("firstLayer", 0);
+			geometryShader.SetInt("endLayer", 1);
+			sampleModel.Draw(geometryShader);
+			gbuffer.CopyDepthCompareLayer();
+			geometryShader.SetInt("firstLayer", 1);
+			geometryShader.SetInt("endLayer", GBUFFER_LAYERS);
+			sampleModel.Draw(geometryShader);
+		}
+		else {
+			geometryShader.SetInt("firstLayer", 0);
+			geometryShader.SetInt("endLayer", GBUFFER_LAYERS);
+			sampleModel.Draw(geometryShader);
+		}
+		if (gbufferMode == GBUFFER_DELAY) {
+			//next frame is rendered with this frame's input, so its first layer can be drawn now
+			gbuffer.BindFramebufferPrediction();
+			glClear(GL_DEPTH_BUFFER_BIT);
+			depthPrepassShader.Use();
+			depthPrepassShader.SetMat4("model", model);
+			depthPrepassShader.SetMat4("view", inputView);
+			depthPrepassShader.SetMat4("projection", projection);
+			sampleModel.DrawDepth();
+		}
+		gbufferTimers[gbufferMode].End();
+		if (measureError) {
+			gbufferReference.Render(depthPrepassShader, depthPeelShader, sampleModel, model, view, projection);
+			gbufferReference.Measure(gbufferErrorShader, gbuffer);
+		}
 
-		//2nd pass: create ssao and render to quad
+		//cull the lights against each screen tile of both layers
+		lightCulling.Cull(lightCullingShader, gbuffer, view, projection);
+
+		//2nd pass: create ssao and render to quad at the reduced resolution, distant samples read coarser levels of the position pyramid
+		positionPyramid.Build(positionMipShader, gbuffer);
 		ssao.BindFramebuffer();
 		glClear(GL_COLOR_BUFFER_BIT);
 		ssaoShader.Use();
-		ssao.BindBuffersSSAO(ssaoShader, gbuffer);
-		ssao.SetUniforms(ssaoShader);
+		ssao.BindBuffersSSAO(ssaoShader, gbuffer, positionPyramid);
 		//glUniform1i(glGetUniformLocation(ssaoShader.Program, "which"), whichSSAO);
 		//glUniformMatrix4fv(glGetUniformLocation(ssaoShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(glGetUniformLocation(ssaoShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+		ssaoShader.SetMat4("projection", projection);
 		RenderQuad();
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-		//3rd pass: blur ssao/ssdo output
-		blur.BindFramebuffer();
-		glClear(GL_COLOR_BUFFER_BIT);
-		blurShader.Use();
-		ssao.BindBuffersBlur(blurShader);
-		RenderQuad();
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		//3rd pass: blur ssao/ssdo output, horizontally then vertically, and upsample it
+		blur.BlurOcclusion(blurShader, upsampleShader, ssao, gbuffer);
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, mWidth, mHeight);
 
 		//4th pass: lighting
 		if (useRadiosity) {
@@ -189,50 +404,57 @@ int main(int argc, char * argv[]) {
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		lightingShader.Use();
 		blur.BindBuffersLighting(lightingShader, gbuffer);
-		//set up lighting uniforms including shadow depth cubemaps
-		for (int i = 0; i < NUM_LIGHTS; i++) {
-			lights[i].SetUniforms(lightingShader, view);
-			lights[i].BindBuffers(lightingShader);
-		}
-		glUniform1f(glGetUniformLocation(lightingShader.Program, "farPlane"), mFar);
-		glUniform1i(glGetUniformLocation(lightingShader.Program, "displayMode"), displayMode);
+		//bind the shadow atlas, the light properties come from the light buffer
+		shadowAtlas.BindBuffers(lightingShader);
+		lightingShader.SetFloat("farPlane", mFar);
+		lightingShader.SetMat4("view", view);
+		lightingShader.SetMat4("invView", glm::inverse(view));
 		RenderQuad();
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
 
-		//5th pass: radiosity
+		//5th pass: radiosity, at the reduced resolution
 		if (useRadiosity) {
 			//glBindFramebuffer(GL_FRAMEBUFFER, 0);
 			blur.BindFramebuffer();
 			glClear(GL_COLOR_BUFFER_BIT);
 			radiosityShader.Use();
 			radiosity.BindBuffersRadiosity(radiosityShader, gbuffer);
-			radiosity.SetUniforms(radiosityShader);
-			glUniform1i(glGetUniformLocation(radiosityShader.Program, "which"), whichRad);
-			glUniformMatrix4fv(glGetUniformLocation(radiosityShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+			radiosityHistory.BindBuffersRadiosity(radiosityShader, view, useBounces);
+			radiosityShader.SetMat4("projection", projection);
+			radiosityShader.SetFloat("sampleRotation", useTemporal ? (frame % 1024) * SAMPLE_ROTATION_STEP : 0.0f);
 			RenderQuad();
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-			//6th: blur radiosity, combine with rest of lighting and display
-			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			//blend with the reprojected radiosity of previous frames
+			if (!useTemporal)
+				radiosityHistory.Invalidate();
+			blur.BindBuffersTemporal(temporalShader);
+			radiosityHistory.Accumulate(temporalShader, gbuffer, view, projection);
+
+			//6th: blur and upsample radiosity, combine with rest of lighting and display
+			blur.BlurRadiosity(blurColorShader, upsampleColorShader, radiosityHistory, gbuffer);
+			GLState::BindFramebuffer(GL_FRAMEBUFFER, 0);
+			glViewport(0, 0, mWidth, mHeight);
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 			blurRadiosityShader.Use();
 			blur.BindBuffersRadiosity(blurRadiosityShader);
 			radiosity.BindBuffersBlur(blurRadiosityShader);
 			RenderQuad();
 		}
+		else
+			radiosityHistory.Invalidate();
 
 		//7th: render a cube for each light source
 		//copy depth buffer from gbuffer to properly occlude light sources
 		glClear(GL_DEPTH_BUFFER_BIT);
 		gbuffer.CopyDepthBuffer();
 		lightSourceShader.Use();
-		glUniformMatrix4fv(glGetUniformLocation(lightSourceShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-		glUniformMatrix4fv(glGetUniformLocation(lightSourceShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-		for (int i = 0; i < NUM_LIGHTS; i++) {
+		lightSourceShader.SetMat4("projection", projection);
+		lightSourceShader.SetMat4("view", view);
+		for (GLuint i = 0; i < lights.size(); i++) {
 			model = glm::mat4();
 			model = glm::translate(model, lights[i].position);
-			glUniformMatrix4fv(glGetUniformLocation(lightSourceShader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-			glUniform3fv(glGetUniformLocation(lightSourceShader.Program, "lightColor"), 1, &lights[i].specular[0]);
+			lightSourceShader.SetMat4("model", model);
+			lightSourceShader.SetVec3("lightColor", lights[i].specular);
 			RenderCube();
 		}
 
@@ -242,18 +464,46 @@ int main(int argc, char * argv[]) {
 		model = glm::mat4();
 		model = glm::scale(model, glm::vec3(2.0f));
 		//ignore translation component of view matrix
-		view = glm::mat4(glm::mat3(camera.GetViewMatrix()));
-		glUniformMatrix4fv(glGetUniformLocation(envShader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-		glUniformMatrix4fv(glGetUniformLocation(envShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-		glUniformMatrix4fv(glGetUniformLocation(envShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+		view = glm::mat4(glm::mat3(view));
+		envShader.SetMat4("model", model);
+		envShader.SetMat4("view", view);
+		envShader.SetMat4("projection", projection);
 		envMap.BindBuffers(envShader);
 		RenderCube();
 		glDepthFunc(GL_LESS);
 
         // Flip Buffers and Draw
         glfwSwapBuffers(mWindow);
+		GLState::EndFrame();
+		if (printStats) {
+			GLState::PrintCounters();
+			for (int mode = 0; mode < SHADOW_MODES; mode++)
+				printf("Shadow pass (mode %d%s): %.3f ms\n", mode, mode == shadowMode ? ", current" : "", shadowTimers[mode].Milliseconds());
+			printf("Shadow mesh draws: %u\n", shadowMeshes);
+			for (int mode = 0; mode < GBUFFER_MODES; mode++)
+				printf("G-buffer (mode %d%s): %.3f ms\n", mode, mode == gbufferMode ? ", current" : "", gbufferTimers[mode].Milliseconds());
+			if (measureError)
+				gbufferReference.Print();
+			printStats = false;
+		}
+
+		//steady-state frames must be allocation free (only checked with COUNT_ALLOCATIONS)
+		frame++;
+		if (AllocationCounter::Enabled() && frame > ALLOCATION_WARMUP_FRAMES && AllocationCounter::Count() != allocations) {
+			fprintf(stderr, "Frame %u made %u heap allocations after warm-up\n", (unsigned)frame, (unsigned)(AllocationCounter::Count() - allocations));
+			return EXIT_FAILURE;
+		}
+		if (exitAfterFrames > 0 && frame == ALLOCATION_WARMUP_FRAMES + exitAfterFrames) {
+			if (AllocationCounter::Enabled())
+				printf("%u frames after warm-up made no heap allocations\n", (unsigned)exitAfterFrames);
+			break;
+		}
+		if (shadowBenchmarkFrames > 0 && frame % shadowBenchmarkFrames == 0) {
+			printf("Shadow pass (mode %d): %.3f ms, %u mesh draws\n", shadowMode, shadowTimers[shadowMode].Milliseconds(), shadowMeshes);
+			if (++shadowMode == SHADOW_MODES)
+				break;
+		}
     }
-	glfwTerminate();
     return EXIT_SUCCESS;
 }
 
@@ -274,7 +524,7 @@ void RenderQuad()
 		// Setup plane VAO
 		glGenVertexArrays(1, &quadVAO);
 		glGenBuffers(1, &quadVBO);
-		glBindVertexArray(quadVAO);
+		GLState::BindVertexArray(quadVAO);
 		glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
 		glEnableVertexAttribArray(0);
@@ -282,9 +532,8 @@ void RenderQuad()
 		glEnableVertexAttribArray(1);
 		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
 	}
-	glBindVertexArray(quadVAO);
+	GLState::BindVertexArray(quadVAO);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-	glBindVertexArray(0);
 }
 
 // RenderCube() Renders a 1x1 3D cube in NDC.
@@ -345,7 +594,7 @@ void RenderCube()
 		glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 		// Link vertex attributes
-		glBindVertexArray(cubeVAO);
+		GLState::BindVertexArray(cubeVAO);
 		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)0);
 		glEnableVertexAttribArray(1);
@@ -353,12 +602,10 @@ void RenderCube()
 		glEnableVertexAttribArray(2);
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), (GLvoid*)(6 * sizeof(GLfloat)));
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
-		glBindVertexArray(0);
 	}
 	// Render Cube
-	glBindVertexArray(cubeVAO);
+	GLState::BindVertexArray(cubeVAO);
 	glDrawArrays(GL_TRIANGLES, 0, 36);
-	glBindVertexArray(0);
 }
 
 // Is called whenever a key is pressed/released via GLFW
@@ -386,9 +633,29 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 	if (key == GLFW_KEY_9 && action == GLFW_PRESS)
 		whichRad = (whichRad + 1) % 3;
 
-	// Toggle radiosity
+	// Print how many binds the state cache issued and skipped and the shadow pass timing
+	if (key == GLFW_KEY_G && action == GLFW_PRESS)
+		printStats = true;
+
+	// Cycle how the second G-buffer layer is generated, and toggle measuring its error
+	if (key == GLFW_KEY_M && action == GLFW_PRESS)
+		gbufferMode = (gbufferMode + 1) % GBUFFER_MODES;
+	if (key == GLFW_KEY_E && action == GLFW_PRESS)
+		measureError = !measureError;
+
+	// Cycle how shadows are drawn, and toggle redrawing them every frame to compare
+	if (key == GLFW_KEY_V && action == GLFW_PRESS)
+		shadowMode = (shadowMode + 1) % SHADOW_MODES;
+	if (key == GLFW_KEY_F && action == GLFW_PRESS)
+		forceShadows = !forceShadows;
+
+	// Toggle radiosity, accumulating it over frames and gathering multiple bounces
 	if (key == GLFW_KEY_R && action == GLFW_PRESS)
 		useRadiosity = !useRadiosity;
+	if (key == GLFW_KEY_T && action == GLFW_PRESS)
+		useTemporal = !useTemporal;
+	if (key == GLFW_KEY_B && action == GLFW_PRESS)
+		useBounces = !useBounces;
 
 	// Set which light to move
 	if (key == GLFW_KEY_1 && action == GLFW_PRESS)
@@ -397,6 +664,8 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 		moveLight = 1;
 	if (key == GLFW_KEY_3 && action == GLFW_PRESS)
 		moveLight = 2;
+	if (moveLight >= (int)lights.size())
+		return;
 	
 	// Light movement
 	if (key == GLFW_KEY_I && (action == GLFW_PRESS || action == GLFW_REPEAT))